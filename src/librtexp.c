@@ -1,111 +1,230 @@
 /* This is a stand-alone implementation of a real-time expiration data store.
- * It is basically a min heap <key, exp_version> sorted by expiration,
- * with a map of [key] -> <exp_version, exp> on the side
+ * It is basically a deadline index (a min heap by default) of element nodes sorted by expiration,
+ * with a key index of [key] -> element node on the side, both pluggable (see rtx_backend.h). Each key has exactly one node, which is
+ * rescheduled and removed in place.
  */
 #include "librtexp.h"
 
-#include "trie/triemap.h"
-#include "util/heap.h"
+#include "util/mempool.h"
 #include "util/millisecond_time.h"
 #include "util/rmalloc.h"
 
+#include <errno.h>
 #include <time.h>
 
-#define RTX_LATANCY_NS 50
+// the version of a node created by set_element_exp_batch, until the batch is scheduled
+#define RTX_BATCH_PENDING -1
+
+#define RTX_NODE_SLAB_SIZE 1024
+#define RTX_KEY_SLAB_SIZE 256
+// size classes for keys too long to be inlined: 32, 64, 128 and 256 bytes (including the '\0')
+#define RTX_KEY_CLASS_MIN 32
+#define RTX_KEY_CLASS_COUNT 4
+
+/***************************
+ *   Memory pools
+ ***************************/
+// shared by all stores, nodes may outlive the store they were popped from
+static mempool_t* node_pool = NULL;
+static mempool_t* key_pools[RTX_KEY_CLASS_COUNT];
+
+void RTXStore_SetAllocator(void* (*alloc)(size_t), void (*free)(void*)) {
+  mempool_set_allocator(alloc, free);
+}
+
+void _init_pools(void) {
+  if (node_pool) return;
+  node_pool = mempool_new(sizeof(RTXElementNode), RTX_NODE_SLAB_SIZE);
+  int i;
+  for (i = 0; i < RTX_KEY_CLASS_COUNT; ++i)
+    key_pools[i] = mempool_new(RTX_KEY_CLASS_MIN << i, RTX_KEY_SLAB_SIZE);
+}
+
+/*
+ * @return the size class of a key, or -1 if it is too long for the key pools
+ */
+int _key_class(size_t len) {
+  int cls = 0;
+  while (cls < RTX_KEY_CLASS_COUNT && (RTX_KEY_CLASS_MIN << cls) < len + 1) cls++;
+  return (cls < RTX_KEY_CLASS_COUNT) ? cls : -1;
+}
+
+/*
+ * @return a copy of the key, copied by its length as it may hold NUL bytes, NULL on failure
+ */
+char* _alloc_key(char* key, size_t len) {
+  int cls = _key_class(len);
+  char* ret = (cls < 0) ? rm_malloc(len + 1) : mempool_alloc(key_pools[cls]);
+  if (ret == NULL) return NULL;
+
+  memcpy(ret, key, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+void _free_key(char* key, size_t len) {
+  int cls = _key_class(len);
+  if (cls < 0)
+    rm_free(key);
+  else
+    mempool_release(key_pools[cls], key);
+}
 
 /***************************
  *   Datastructure Utils
  ***************************/
-RTXElementNode* newRTXElementNode(char* key, size_t len, mstime_t timestamp_ms, int version) {
-  RTXElementNode* node = malloc(sizeof(RTXElementNode));
-  node->key = rm_strndup(key, len);
+/*
+ * Give the node a copy of the key, leaving the node as it was on failure
+ * @return RTXS_OK on success, RTXS_ERR if the key could not be allocated
+ */
+int _set_node_key(RTXElementNode* node, char* key, size_t len) {
+  if (len <= RTX_INLINE_KEY_LEN) {
+    node->key = node->inline_key;
+    memcpy(node->key, key, len);
+    node->key[len] = '\0';
+  } else {
+    char* copy = _alloc_key(key, len);
+    if (copy == NULL) return RTXS_ERR;
+    node->key = copy;
+  }
   node->len = len;
+  return RTXS_OK;
+}
+
+/*
+ * @return a new node holding a copy of the key, NULL on failure
+ */
+RTXElementNode* newRTXElementNode(char* key, size_t len, mstime_t timestamp_ms, int version) {
+  RTXElementNode* node = mempool_alloc(node_pool);
+  if (node == NULL) return NULL;
+  if (_set_node_key(node, key, len) != RTXS_OK) {
+    mempool_release(node_pool, node);
+    return NULL;
+  }
   node->exp.time = timestamp_ms;
   node->exp.version = version;
+  node->refcount = 1;
+  node->claimed = 0;
+  return node;
+}
+
+RTXElementNode* retainRTXElementNode(RTXElementNode* node) {
+  node->refcount++;
   return node;
 }
 
 void freeRTXElementNode(RTXElementNode* node) {
-  rm_free(node->key);
-  rm_free(node);
+  if (--node->refcount > 0) return;
+  if (node->key != node->inline_key) _free_key(node->key, node->len);
+  mempool_release(node_pool, node);
+}
+
+void _freeRTXElementNodeCB(void* node) {
+  freeRTXElementNode(node);
 }
 
 size_t expiration_count(RTXStore* store){
   if (store){
-    return store->sorted_keys->count;
+    // claimed keys are only in the key index until they are expired
+    return store->key_type->count(store->key_index);
   }
   return 0;
 }
 
+size_t RTXStore_MemUsage(RTXStore* store) {
+  return sizeof(RTXStore) + store->deadline_type->memusage(store->deadline_index) +
+         store->key_type->memusage(store->key_index);
+}
+
 void RTXStore_Free(RTXStore* store) {
-  TrieMap_Free(store->element_node_map, NULL);
-  while (store->sorted_keys->count != 0) {
-    RTXElementNode* node = heap_poll(store->sorted_keys);
-    freeRTXElementNode(node);
-  }  
-  heap_free(store->sorted_keys);
+  // the key index owns the nodes, the deadline index only points to them
+  store->key_type->free(store->key_index, _freeRTXElementNodeCB);
+  store->deadline_type->free(store->deadline_index);
   rm_free(store);
 }
 
 /*
- * Update expiration, increase the version num, keep the name
+ * @return the node with the closest expiration, NULL if DS empty
  */
-void* _trie_node_updater(void* oldval, void* newval) {
-  RTXExpiration *n = newval, *o = oldval;
-  if (o) {
-    n->version = o->version+1;
-    rm_free(o);
-  }
-  
-  return newval;  
+RTXElementNode* _peek_next(RTXStore* store) {
+  return store->deadline_type->peek(store->deadline_index);
 }
 
-int _cmp_node(const void* node_a, const void* node_b, const void* udata) {
-  const RTXElementNode *a=node_a, *b=node_b;
-  if (b->exp.time < a->exp.time)
-    return -1;
-  else if (b->exp.time > a->exp.time)
-    return 1;
-  return 0;
+/*
+ * @return the node stored for the given key, NULL if there is none
+ */
+RTXElementNode* _find_node(RTXStore* store, char* key, size_t len) {
+  return store->key_type->find(store->key_index, key, len);
+}
+
+RTXStore* newRTXStore(void) {
+  return newRTXStoreWithBackend(RTXS_BACKEND_HEAP);
+}
+
+RTXStore* newRTXStoreWithBackend(RTXBackend backend) {
+  return newRTXStoreWithBackends(backend, RTXS_KEYS_TRIE);
+}
+
+RTXStore* newRTXStoreWithBackends(RTXBackend backend, RTXKeyBackend keys) {
+  _init_pools();
+  RTXStore* store = malloc(sizeof(RTXStore));
+  store->deadline_type = RTXDeadlineIndex_Type(backend);
+  store->deadline_index = store->deadline_type->create();
+  store->key_type = RTXKeyIndex_Type(keys);
+  store->key_index = store->key_type->create();
+  store->precision_ms = 1;
+  return store;
+}
+
+int RTXStore_SetPrecision(RTXStore* store, mstime_t precision_ms) {
+  if (precision_ms <= 0) return RTXS_ERR;
+  store->precision_ms = precision_ms;
+  return RTXS_OK;
 }
 
 /*
- * @return True if node has a valid version
+ * @return the deadline ttl_ms from now, rounded up to a multiple of precision_ms
  */
-int _is_valid_node(RTXStore* store, RTXElementNode* node) {
-  if (node == NULL || node == TRIEMAP_NOTFOUND || node->key == NULL) {
-    return 0;
-  }
-  char* key = node->key;
-  RTXExpiration* stored_node = TrieMap_Find(store->element_node_map, key, strlen(key));
-  if (stored_node != NULL && stored_node != TRIEMAP_NOTFOUND)
-    return (node->exp.version == stored_node->version);
-  else
-    return 0;
+mstime_t expiration_deadline(mstime_t now, mstime_t ttl_ms, mstime_t precision_ms) {
+  mstime_t timestamp_ms = now + ttl_ms;
+  if (precision_ms <= 1) return timestamp_ms;
+  return (timestamp_ms + precision_ms - 1) / precision_ms * precision_ms;
 }
 
 /*
- * @return next valid element node, NULL if DS empty
+ * Reschedule a node that is already in the store, in place. A claimed node is scheduled anew.
+ * @return RTXS_OK on success, RTXS_ERR if the node could not be scheduled and was removed
  */
-RTXElementNode* _peek_next(RTXStore* store) {
-  while (store->sorted_keys->count != 0) {
-    RTXElementNode* node = heap_peek(store->sorted_keys);
-    // printf("peeked and saw:%s\n", node->key);
-    if (_is_valid_node(store, node)) {
-      return node;
-    } else {
-      RTXElementNode* polled_node = heap_poll(store->sorted_keys);
-      freeRTXElementNode(polled_node);
-    }
+int _reschedule(RTXStore* store, RTXElementNode* node, mstime_t timestamp_ms) {
+  node->exp.time = timestamp_ms;
+  node->exp.version++;
+  int failed;
+  if (node->claimed) {
+    node->claimed = 0;
+    failed = store->deadline_type->offer(store->deadline_index, node) != 0;
+  } else {
+    failed = store->deadline_type->update(store->deadline_index, node) != 0;
   }
-  return NULL;
+
+  if (failed) {
+    // out of the deadline index for good, drop the expiration rather than keep a node never due
+    store->key_type->del(store->key_index, node->key, node->len);
+    freeRTXElementNode(node);
+    return RTXS_ERR;
+  }
+  return RTXS_OK;
 }
 
-RTXStore* newRTXStore(void) {
-  RTXStore* store = malloc(sizeof(RTXStore));
-  store->sorted_keys = heap_new(_cmp_node, NULL);
-  store->element_node_map = NewTrieMap();
-  return store;
+/*
+ * Remove a node from both indexes and drop the store's reference
+ */
+void _remove_node(RTXStore* store, RTXElementNode* node) {
+  if (node->claimed)
+    node->claimed = 0;  // a claimed node is no longer in the deadline index
+  else
+    store->deadline_type->remove(store->deadline_index, node);
+  store->key_type->del(store->key_index, node->key, node->len);
+  freeRTXElementNode(node);
 }
 
 /************************************
@@ -117,34 +236,135 @@ RTXStore* newRTXStore(void) {
  * @return RTXS_OK on success, RTXS_ERR on error
  */
 int set_element_exp(RTXStore* store, char* key, size_t len, mstime_t ttl_ms) {
-  mstime_t timestamp_ms = current_time_ms() + ttl_ms;
-  RTXExpiration* exp = malloc(sizeof(*exp)); 
+  return set_element_exp_precision(store, key, len, ttl_ms, store->precision_ms);
+}
+
+/*
+ * Insert expiration for a new key or update an existing one, at the given precision
+ * @return RTXS_OK on success, RTXS_ERR on error
+ */
+int set_element_exp_precision(RTXStore* store, char* key, size_t len, mstime_t ttl_ms,
+                              mstime_t precision_ms) {
+  return set_element_exp_at(store, key, len,
+                            expiration_deadline(current_time_ms(), ttl_ms, precision_ms));
+}
+
+/*
+ * Insert expiration for a new key or update an existing one, at the given datetime
+ * @return RTXS_OK on success, RTXS_ERR on error
+ */
+int set_element_exp_at(RTXStore* store, char* key, size_t len, mstime_t timestamp_ms) {
+  RTXElementNode* node = _find_node(store, key, len);
+  if (node != NULL) {
+    return _reschedule(store, node, timestamp_ms);
+  }
+
   //printf("settting timestamp to be %llu\n", timestamp_ms);
-  exp->time = timestamp_ms;
-  exp->version = 0; 
-  
-  int trie_result = TrieMap_Add(store->element_node_map, key, len, exp, _trie_node_updater);
-  
-  // EXP's version was updated by the trie updater callback
-  RTXElementNode *node = newRTXElementNode(key, len, exp->time, exp->version);
-
-  int heap_result = heap_offer(&store->sorted_keys, node);
-  if (heap_result != 0) {  // we failed inserting into the heap, back out of everything
-    // TODO: for now let's (wrongly) assume we will not get here and just return with error, but
-    //       this needs writing
+  node = newRTXElementNode(key, len, timestamp_ms, 0);
+  if (node == NULL) {
+    return RTXS_ERR;
+  }
+  if (store->deadline_type->offer(store->deadline_index, node) != 0) {
+    // we failed inserting into the deadline index, back out
+    freeRTXElementNode(node);
+    return RTXS_ERR;
+  }
+  if (store->key_type->add(store->key_index, node) != 0) {
+    store->deadline_type->remove(store->deadline_index, node);
+    freeRTXElementNode(node);
     return RTXS_ERR;
   }
   return RTXS_OK;
 }
 
+/*
+ * Insert or update the expirations of n keys at once
+ * @return RTXS_OK on success, RTXS_ERR if any of the keys could not be stored
+ */
+int set_element_exp_batch(RTXStore* store, char** keys, size_t* lens, mstime_t* ttls, size_t n) {
+  if (n == 0) return RTXS_OK;
+  mstime_t* timestamps = rm_malloc(n * sizeof(mstime_t));
+  if (timestamps == NULL) return RTXS_ERR;
+
+  mstime_t now = current_time_ms();
+  size_t i;
+  for (i = 0; i < n; ++i) timestamps[i] = expiration_deadline(now, ttls[i], store->precision_ms);
+  int ret = set_element_exp_batch_at(store, keys, lens, timestamps, n);
+  rm_free(timestamps);
+  return ret;
+}
+
+/*
+ * Insert or update the expirations of n keys at once, at the given datetimes
+ * @return RTXS_OK on success, RTXS_ERR if any of the keys could not be stored
+ */
+int set_element_exp_batch_at(RTXStore* store, char** keys, size_t* lens, mstime_t* timestamps,
+                             size_t n) {
+  if (n == 0) return RTXS_OK;
+  RTXElementNode** fresh = rm_malloc(n * sizeof(RTXElementNode*));
+  if (fresh == NULL) return RTXS_ERR;
+
+  size_t i, added = 0;
+  int ret = RTXS_OK;
+  for (i = 0; i < n; ++i) {
+    RTXElementNode* node = _find_node(store, keys[i], lens[i]);
+    mstime_t timestamp_ms = timestamps[i];
+    if (node == NULL) {
+      // known by key right away, but only scheduled with the rest of the batch
+      node = newRTXElementNode(keys[i], lens[i], timestamp_ms, RTX_BATCH_PENDING);
+      if (node == NULL) {
+        ret = RTXS_ERR;
+        continue;
+      }
+      if (store->key_type->add(store->key_index, node) != 0) {
+        freeRTXElementNode(node);
+        ret = RTXS_ERR;
+        continue;
+      }
+      fresh[added++] = node;
+    } else if (node->exp.version == RTX_BATCH_PENDING) {
+      // a key given twice, not scheduled yet
+      node->exp.time = timestamp_ms;
+    } else if (_reschedule(store, node, timestamp_ms) != RTXS_OK) {
+      ret = RTXS_ERR;
+    }
+  }
+
+  size_t scheduled = store->deadline_type->offer_batch(store->deadline_index, fresh, added);
+  for (i = 0; i < added; ++i) {
+    if (i < scheduled) {
+      fresh[i]->exp.version = 0;
+    } else {
+      // we failed inserting into the deadline index, back out
+      store->key_type->del(store->key_index, fresh[i]->key, fresh[i]->len);
+      freeRTXElementNode(fresh[i]);
+      ret = RTXS_ERR;
+    }
+  }
+  rm_free(fresh);
+  return ret;
+}
+
+/*
+ * Update the expiration of a key that is already in the store, in place
+ * @return RTXS_OK on success, RTXS_ERR if the key has no expiration
+ */
+int update_element_exp(RTXStore* store, char* key, size_t len, mstime_t ttl_ms) {
+  RTXElementNode* node = _find_node(store, key, len);
+  if (node == NULL) {
+    return RTXS_ERR;
+  }
+  return _reschedule(store, node, expiration_deadline(current_time_ms(), ttl_ms, store->precision_ms));
+}
+
 /*
  * Get the expiration value for the given key
  * @return datetime of expiration (in milliseconds) on success, -1 on error
  */
 mstime_t get_element_exp(RTXStore* store, char* key) {
-  RTXExpiration* exp = TrieMap_Find(store->element_node_map, key, strlen(key));
-  if (exp != NULL && exp != TRIEMAP_NOTFOUND) {
-    return exp->time;
+  RTXElementNode* node = _find_node(store, key, strlen(key));
+  if (node != NULL) {
+    return node->exp.time;
   }
   return -1;
 }
@@ -154,7 +374,55 @@ mstime_t get_element_exp(RTXStore* store, char* key) {
  * @return RTXS_OK
  */
 int del_element_exp(RTXStore* store, char* key) {
-  TrieMap_Delete(store->element_node_map, key, strlen(key), NULL);
+  return del_element_exp_len(store, key, strlen(key));
+}
+
+/*
+ * Remove expiration from the data store for the given key of length len
+ * @return RTXS_OK
+ */
+int del_element_exp_len(RTXStore* store, char* key, size_t len) {
+  RTXElementNode* node = _find_node(store, key, len);
+  if (node != NULL) {
+    _remove_node(store, node);
+  }
+  return RTXS_OK;
+}
+
+/*
+ * Move the expiration of a key to a new name, replacing the new name's own expiration if any
+ * @return RTXS_OK if the key had an expiration, RTXS_ERR if it had none
+ */
+int rename_element_exp(RTXStore* store, char* key, size_t len, char* new_key, size_t new_len) {
+  if (len == new_len && memcmp(key, new_key, len) == 0) {
+    return _find_node(store, key, len) ? RTXS_OK : RTXS_ERR;
+  }
+  RTXElementNode* replaced = _find_node(store, new_key, new_len);
+  if (replaced != NULL) {
+    _remove_node(store, replaced);
+  }
+  RTXElementNode* node = _find_node(store, key, len);
+  if (node == NULL) {
+    return RTXS_ERR;
+  }
+  // the node keeps its place in the deadline index, or its claim, and only changes its name, so
+  // a key that is already due is neither rescheduled into the past nor left unexpired
+  char* old_key = node->key;
+  size_t old_len = node->len;
+  store->key_type->del(store->key_index, node->key, node->len);
+  int renamed = _set_node_key(node, new_key, new_len) == RTXS_OK;
+  if (renamed && old_key != node->inline_key) {
+    _free_key(old_key, old_len);
+  }
+  if (!renamed || store->key_type->add(store->key_index, node) != 0) {
+    // a node the key index does not know could never be removed, drop the expiration
+    if (node->claimed)
+      node->claimed = 0;
+    else
+      store->deadline_type->remove(store->deadline_index, node);
+    freeRTXElementNode(node);
+    return RTXS_ERR;
+  }
   return RTXS_OK;
 }
 
@@ -170,22 +438,58 @@ mstime_t next_at(RTXStore* store) {
   }
 }
 
-void _voidCB(void *elem) { return; }
-
 /*
  * Remove the element with the closest expiration datetime from the data store and return it's key
  * @return the node of the element with closest expiration datetime
  */
 RTXElementNode* pop_next(RTXStore* store) {
-  RTXElementNode* node = _peek_next(store);
+  RTXElementNode* node = store->deadline_type->poll(store->deadline_index);
   if (node != NULL) {  // a non empty DS
-    node = heap_poll(store->sorted_keys);
-    TrieMap_Delete(store->element_node_map, node->key, node->len, _voidCB);
+    // the store's reference moves to the caller
+    store->key_type->del(store->key_index, node->key, node->len);
     return node;
   }
   return NULL;
 }
 
+/*
+ * Remove every element expiring at or before now, up to max of them
+ * @return the number of nodes written into out
+ */
+size_t pop_due(RTXStore* store, mstime_t now, RTXElementNode** out, size_t max) {
+  size_t i, n = store->deadline_type->poll_due(store->deadline_index, now, out, max);
+  // the store's references move to the caller
+  for (i = 0; i < n; ++i) store->key_type->del(store->key_index, out[i]->key, out[i]->len);
+  return n;
+}
+
+/*
+ * Claim every element expiring at or before now, up to max of them
+ * @return the number of nodes written into out
+ */
+size_t claim_due(RTXStore* store, mstime_t now, RTXElementNode** out, int* versions, size_t max) {
+  size_t i, n = store->deadline_type->poll_due(store->deadline_index, now, out, max);
+  // the store keeps its references through the key index, the caller gets one more
+  for (i = 0; i < n; ++i) {
+    out[i]->claimed = 1;
+    versions[i] = out[i]->exp.version;
+    retainRTXElementNode(out[i]);
+  }
+  return n;
+}
+
+/*
+ * Remove a claimed element from the store, unless it changed since it was claimed
+ * @return RTXS_OK if the element was removed, RTXS_ERR if it is not
+ */
+int expire_claimed(RTXStore* store, RTXElementNode* node, int version) {
+  if (!node->claimed || node->exp.version != version) return RTXS_ERR;
+  node->claimed = 0;
+  store->key_type->del(store->key_index, node->key, node->len);
+  freeRTXElementNode(node);
+  return RTXS_OK;
+}
+
 /*
  * Wait Remove the element with the closest expiration datetime from the data store and return it's
  * key
@@ -193,12 +497,12 @@ RTXElementNode* pop_next(RTXStore* store) {
  */
 RTXElementNode* pop_wait(RTXStore* store) {
   mstime_t sleep_target_ms = next_at(store);
-  mstime_t time_to_wait = sleep_target_ms - current_time_ms();
-  if (time_to_wait > 0) {
-    struct timespec ttw, rem;
-    ttw.tv_sec = 0;
-    ttw.tv_nsec = time_to_wait * 1000 - RTX_LATANCY_NS;
-    nanosleep(&ttw, &rem);  // TODO: for now we'll assume this is allways fully successfull
+  if (sleep_target_ms > current_time_ms()) {
+    // sleep until the deadline itself rather than for a duration, so an interrupted sleep resumes
+    struct timespec at = {.tv_sec = sleep_target_ms / 1000,
+                          .tv_nsec = (sleep_target_ms % 1000) * 1000000};
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &at, NULL) == EINTR) {
+    }
   }
   return pop_next(store);
 }
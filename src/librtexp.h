@@ -1,13 +1,19 @@
 #ifndef RTX_STORE_H
 #define RTX_STORE_H
 
-#include "trie/triemap.h"
-#include "util/heap.h"
+#include "util/bucket_heap.h"
 #include "util/millisecond_time.h"
+#include "util/radix_heap.h"
+#include "util/timing_wheel.h"
 
 #define RTXS_OK 0
 #define RTXS_ERR 1
 
+#include "rtx_backend.h"
+
+// keys up to this length are stored inside their node, without another allocation
+#define RTX_INLINE_KEY_LEN 24
+
 /***************************
  *        STRUCTS
  ***************************/
@@ -18,14 +24,26 @@ typedef struct {
 } RTXExpiration;
 
 typedef struct rtxs_node {
-  char* key;
+  char* key;                  // points to inline_key for short keys
   size_t len;
   RTXExpiration exp;
+  int refcount;               // the store holds one reference while the node is scheduled
+  unsigned char claimed;      // out of the deadline index, due to be expired (see claim_due)
+  union {                     // where the node is kept in the deadline index
+    unsigned int heap_idx;    // heap backend: index in the heap's array
+    wheel_node_t wheel_link;  // wheel backend: link in its wheel slot
+    radix_node_t radix_link;  // radix backend: link in its bucket
+    bheap_link_t bucket_link; // bucket backend: its deadline's bucket and index in it
+  };
+  char inline_key[RTX_INLINE_KEY_LEN + 1];
 } RTXElementNode;
 
 typedef struct rtxs_store {
-  heap_t* sorted_keys;        // <key, exp_version, timestamp> (sorted by [exp_timestamp])
-  TrieMap* element_node_map;  // [key] -> <exp_version, exp_timestamp>
+  const RTXDeadlineIndexType* deadline_type;
+  void* deadline_index;  // <element node> (sorted by [exp_timestamp])
+  const RTXKeyIndexType* key_type;
+  void* key_index;  // [key] -> <element node>
+  mstime_t precision_ms;  // deadlines are rounded up to a multiple of it, 1 keeps them exact
 } RTXStore;
 
 /***************************
@@ -33,23 +51,99 @@ typedef struct rtxs_store {
  ***************************/
 RTXStore* newRTXStore(void);
 
+/*
+ * Create a store ordering its expirations with the given backend
+ */
+RTXStore* newRTXStoreWithBackend(RTXBackend backend);
+
+/*
+ * Create a store with the given deadline index and key index
+ */
+RTXStore* newRTXStoreWithBackends(RTXBackend backend, RTXKeyBackend keys);
+
 void RTXStore_Free(RTXStore* store);
 
+/*
+ * Set the allocator used for the memory pools holding element nodes and their keys.
+ * Must be called before the first store is created.
+ */
+void RTXStore_SetAllocator(void* (*alloc)(size_t), void (*free)(void*));
+
+/*
+ * Set the store's default expiration precision. Deadlines are rounded up to the next multiple
+ * of precision_ms, so keys expiring within the same window share a single deadline and are
+ * expired together. 1 (the default) keeps every deadline exact.
+ * @return RTXS_OK on success, RTXS_ERR if precision_ms is not positive
+ */
+int RTXStore_SetPrecision(RTXStore* store, mstime_t precision_ms);
+
 /************************************
  *   General DS handling functions
  ************************************/
 
 /*
- * @return the number of uniqe expiration entries in the store
+ * @return the expiration datetime ttl_ms after now, rounded up to a multiple of precision_ms
+ */
+mstime_t expiration_deadline(mstime_t now, mstime_t ttl_ms, mstime_t precision_ms);
+
+/*
+ * @return the number of keys with an expiration in the store, claimed ones included
  */
 size_t expiration_count(RTXStore* store);
 
 /*
- * Insert expiration for a new key or update an existing one
+ * @return the number of bytes held by the store's indexes, not counting the element nodes
+ */
+size_t RTXStore_MemUsage(RTXStore* store);
+
+/*
+ * Insert expiration for a new key or update an existing one.
+ * An existing key is rescheduled in place like in update_element_exp, O(log n) for both cases.
+ * The deadline is rounded to the store's default precision.
  * @return RTXS_OK on success, RTXS_ERR on error
  */
 int set_element_exp(RTXStore* store, char* key, size_t len, mstime_t ttl_ms);
 
+/*
+ * Same as set_element_exp, rounding the deadline up to a multiple of precision_ms rather than
+ * the store's default precision. A key expires at most precision_ms - 1 milliseconds late.
+ * @return RTXS_OK on success, RTXS_ERR on error
+ */
+int set_element_exp_precision(RTXStore* store, char* key, size_t len, mstime_t ttl_ms,
+                              mstime_t precision_ms);
+
+/*
+ * Same as set_element_exp, at a given expiration datetime (in milliseconds), which is kept as it
+ * is. Together with expiration_deadline, the deadline can be worked out apart from storing it.
+ * @return RTXS_OK on success, RTXS_ERR on error
+ */
+int set_element_exp_at(RTXStore* store, char* key, size_t len, mstime_t timestamp_ms);
+
+/*
+ * Insert or update the expirations of n keys at once, keys[i] of length lens[i] expiring in
+ * ttls[i] milliseconds. Keys already in the store are rescheduled in place, and the new ones are
+ * handed to the deadline index together, so a heap can be rebuilt in O(n) rather than sifting up
+ * every key (see dheap_offer_batch). A key given more than once takes its last ttl. Deadlines
+ * are rounded to the store's default precision.
+ * @return RTXS_OK on success, RTXS_ERR if any of the keys could not be stored
+ */
+int set_element_exp_batch(RTXStore* store, char** keys, size_t* lens, mstime_t* ttls, size_t n);
+
+/*
+ * Same as set_element_exp_batch, keys[i] expiring at the datetime timestamps[i], kept as it is
+ * @return RTXS_OK on success, RTXS_ERR if any of the keys could not be stored
+ */
+int set_element_exp_batch_at(RTXStore* store, char** keys, size_t* lens, mstime_t* timestamps,
+                             size_t n);
+
+/*
+ * Update the expiration of a key that is already in the store.
+ * The key's node is found once and rescheduled in place, without allocating a node.
+ * @return RTXS_OK on success, RTXS_ERR if the key has no expiration, or could not be rescheduled
+ * and lost it
+ */
+int update_element_exp(RTXStore* store, char* key, size_t len, mstime_t ttl_ms);
+
 /*
  * Get the expiration value for the given key
  * @return datetime of expiration (in milliseconds) on success, -1 on error
@@ -57,11 +151,26 @@ int set_element_exp(RTXStore* store, char* key, size_t len, mstime_t ttl_ms);
 mstime_t get_element_exp(RTXStore* store, char* key);
 
 /*
- * Remove expiration from the data store for the given key
+ * Remove expiration from the data store for the given key, O(log n)
  * @return RTXS_OK
  */
 int del_element_exp(RTXStore* store, char* key);
 
+/*
+ * Same as del_element_exp, for a key of length len, which may hold NUL bytes
+ * @return RTXS_OK
+ */
+int del_element_exp_len(RTXStore* store, char* key, size_t len);
+
+/*
+ * Move the expiration of a key to new_key, keeping its expiration datetime, e.g. after the key
+ * was renamed. An expiration new_key already had is removed, like the key it belonged to.
+ * The key's node is renamed in place without being rescheduled, O(1) in the deadline index, so a
+ * claimed key (see claim_due) is expired under its new name by expire_claimed.
+ * @return RTXS_OK if the key had an expiration, RTXS_ERR if it had none or on error
+ */
+int rename_element_exp(RTXStore* store, char* key, size_t len, char* new_key, size_t new_len);
+
 /*
  * @return the closest element expiration datetime (in milliseconds), or -1 if DS is empty
  */
@@ -69,10 +178,34 @@ mstime_t next_at(RTXStore* store);
 
 /*
  * Remove the element with the closest expiration datetime from the data store and return it's key
- * @return the key of the element with closest expiration datetime
+ * @return the node of the element with closest expiration datetime, owned by the caller
  */
 RTXElementNode* pop_next(RTXStore* store);
 
+/*
+ * Remove every element expiring at or before now, up to max of them, in order of expiration.
+ * A tick can drain all due elements in batches into the same buffer, reading the clock once.
+ * @return the number of nodes written into out, each owned by the caller
+ */
+size_t pop_due(RTXStore* store, mstime_t now, RTXElementNode** out, size_t max);
+
+/*
+ * Claim every element expiring at or before now, up to max of them, in order of expiration.
+ * Claimed elements leave the deadline index but are still known by key, so the work of finding
+ * them can be done apart from expiring them with expire_claimed, e.g. before taking a lock.
+ * Rescheduling or removing a claimed element in between works as usual and changes its version.
+ * @return the number of nodes written into out, each with a reference taken for the caller, and
+ * their versions written into versions
+ */
+size_t claim_due(RTXStore* store, mstime_t now, RTXElementNode** out, int* versions, size_t max);
+
+/*
+ * Remove a claimed element from the store, unless it was rescheduled or removed since it was
+ * claimed at that version. The caller's reference from claim_due is still the caller's to free.
+ * @return RTXS_OK if the element was removed and is to be expired, RTXS_ERR if it is not
+ */
+int expire_claimed(RTXStore* store, RTXElementNode* node, int version);
+
 /*
  * Wait Remove the element with the closest expiration datetime from the data store and return it's
  * key
@@ -81,7 +214,13 @@ RTXElementNode* pop_next(RTXStore* store);
 RTXElementNode* pop_wait(RTXStore* store);
 
 /*
- * Gracefully free nodes
+ * Take another reference to a node, keeping it alive after it leaves the store
+ * @return the node
+ */
+RTXElementNode* retainRTXElementNode(RTXElementNode* node);
+
+/*
+ * Gracefully free nodes - drop a reference, the node is freed with its last reference
  */
 void freeRTXElementNode(RTXElementNode* node);
 #endif
@@ -3,14 +3,48 @@
 #include <stdlib.h>
 #include <errno.h>
 
+// the early wake offset is the p99 overshoot of a window of wakeups - its 2nd largest of 100 -
+// smoothed across windows with an EWMA of weight 1/8
+#define RMUTIL_TIMER_WINDOW 100
+#define RMUTIL_TIMER_EWMA_SHIFT 3
+
+// Linux timers wait on a timerfd, which another thread re-arms with a single syscall, and an
+// eventfd to be woken for termination. Elsewhere they wait on a condition variable.
+#ifdef __linux__
+#define RMUTIL_TIMERFD
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
 typedef struct RMUtilTimer {
   RMutilTimerFunc cb;
   RMUtilTimerTerminationFunc onTerm;
   void *privdata;
+  // periodic timers only, zero for deadline timers
   struct timespec interval;
   pthread_t thread;
   pthread_mutex_t lock;
+  // the next time to run the callback on CLOCK_MONOTONIC, if hasDeadline is set
+  struct timespec wakeAt;
+  int hasDeadline;
+  int terminated;
+  // spinning: the longest to spin for, 0 to never spin, and how early to wake up to spin
+  long long maxSpinNs;
+  long long earlyNs;
+  // the current window of oversleep samples, and its two largest
+  int samples;
+  long long top[2];
+  RMUtilTimerStats stats;
+#ifdef RMUTIL_TIMERFD
+  int timerFd;
+  int eventFd;
+#else
   pthread_cond_t cond;
+#endif
 } RMUtilTimer;
 
 static struct timespec timespecAdd(struct timespec *a, struct timespec *b) {
@@ -23,34 +57,202 @@ static struct timespec timespecAdd(struct timespec *a, struct timespec *b) {
   return ret;
 }
 
-static void *rmutilTimer_Loop(void *ctx) {
-  RMUtilTimer *tm = ctx;
+static int timespecBefore(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static long long timespecDiffNs(const struct timespec *a, const struct timespec *b) {
+  return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static struct timespec timespecSubNs(const struct timespec *a, long long ns) {
+  long long t = a->tv_sec * 1000000000LL + a->tv_nsec - ns;
+  return (struct timespec){.tv_sec = t / 1000000000, .tv_nsec = t % 1000000000};
+}
 
-  int rc = ETIMEDOUT;
-  struct timespec ts;
+// when to wake up for wakeAt, early enough to spin the rest of the way
+static struct timespec rmutilTimer_ArmTime(RMUtilTimer *tm) {
+  long long early = tm->earlyNs < tm->maxSpinNs ? tm->earlyNs : tm->maxSpinNs;
+  return early > 0 ? timespecSubNs(&tm->wakeAt, early) : tm->wakeAt;
+}
+
+// learn by how much the thread oversleeps its wake up time
+static void rmutilTimer_Sample(RMUtilTimer *tm, long long overshoot) {
+  if (overshoot > tm->top[0]) {
+    tm->top[1] = tm->top[0];
+    tm->top[0] = overshoot;
+  } else if (overshoot > tm->top[1]) {
+    tm->top[1] = overshoot;
+  }
+  if (++tm->samples < RMUTIL_TIMER_WINDOW) return;
+
+  tm->earlyNs += (tm->top[1] - tm->earlyNs) >> RMUTIL_TIMER_EWMA_SHIFT;
+  tm->samples = 0;
+  tm->top[0] = tm->top[1] = 0;
+}
+
+static void rmutilTimer_SpinUntil(const struct timespec *at) {
+  struct timespec now;
+  do {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while (timespecBefore(&now, at));
+}
+
+/* Platform specific waiting, all called with the timer's lock held */
+
+#ifdef RMUTIL_TIMERFD
+
+static int rmutilTimer_InitWait(RMUtilTimer *tm) {
+  tm->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  tm->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (tm->timerFd < 0 || tm->eventFd < 0) {
+    if (tm->timerFd >= 0) close(tm->timerFd);
+    if (tm->eventFd >= 0) close(tm->eventFd);
+    return -1;
+  }
+  return 0;
+}
+
+static void rmutilTimer_FreeWait(RMUtilTimer *tm) {
+  close(tm->timerFd);
+  close(tm->eventFd);
+}
 
+// (re-)arm the timer for wakeAt, taking effect right away
+static void rmutilTimer_Arm(RMUtilTimer *tm) {
+  struct itimerspec spec = {.it_interval = {0, 0}, .it_value = rmutilTimer_ArmTime(tm)};
+  timerfd_settime(tm->timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void rmutilTimer_Signal(RMUtilTimer *tm) {
+  uint64_t one = 1;
+  if (write(tm->eventFd, &one, sizeof(one)) < 0) perror("Error signaling timer");
+}
+
+// wait for the timer to fire or be signaled, the caller re-checks why it woke up
+static void rmutilTimer_Wait(RMUtilTimer *tm) {
+  struct pollfd fds[2] = {{.fd = tm->timerFd, .events = POLLIN}, {.fd = tm->eventFd, .events = POLLIN}};
+  uint64_t count;
+
+  pthread_mutex_unlock(&tm->lock);
+  if (poll(fds, 2, -1) < 0 && errno != EINTR) perror("Error waiting for timer");
+  // clear both, the fds are non blocking
+  if (read(tm->timerFd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("Error reading timer");
+  if (read(tm->eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("Error reading timer");
   pthread_mutex_lock(&tm->lock);
-  while (rc != 0) {
-    clock_gettime(CLOCK_REALTIME, &ts);
-    struct timespec timeout = timespecAdd(&ts, &tm->interval);
-    if ((rc = pthread_cond_timedwait(&tm->cond, &tm->lock, &timeout)) == ETIMEDOUT) {
+}
+
+#else
+
+static int rmutilTimer_InitWait(RMUtilTimer *tm) {
+  // deadlines are on the monotonic clock, immune to wall clock jumps
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  int rc = pthread_cond_init(&tm->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  return rc == 0 ? 0 : -1;
+}
+
+static void rmutilTimer_FreeWait(RMUtilTimer *tm) {
+  pthread_cond_destroy(&tm->cond);
+}
+
+static void rmutilTimer_Arm(RMUtilTimer *tm) {
+  pthread_cond_signal(&tm->cond);
+}
 
-      // Create a thread safe context if we're running inside redis
-      RedisModuleCtx *rctx = NULL;
-      if (RedisModule_GetThreadSafeContext) rctx = RedisModule_GetThreadSafeContext(NULL);
+static void rmutilTimer_Signal(RMUtilTimer *tm) {
+  pthread_cond_signal(&tm->cond);
+}
+
+static void rmutilTimer_Wait(RMUtilTimer *tm) {
+  struct timespec armAt = rmutilTimer_ArmTime(tm);
+  int rc = tm->hasDeadline ? pthread_cond_timedwait(&tm->cond, &tm->lock, &armAt)
+                           : pthread_cond_wait(&tm->cond, &tm->lock);
+  if (rc == EINVAL) perror("Error waiting for condition");
+}
 
-      // call our callback...
-      tm->cb(rctx, tm->privdata);
+#endif
 
-      // If needed - free the thread safe context.
-      // It's up to the user to decide whether automemory is active there
-      if (rctx) RedisModule_FreeThreadSafeContext(rctx);
+static void rmutilTimer_Run(RMUtilTimer *tm) {
+  // Create a thread safe context if we're running inside redis
+  RedisModuleCtx *rctx = NULL;
+  if (RedisModule_GetThreadSafeContext) rctx = RedisModule_GetThreadSafeContext(NULL);
+
+  // call our callback...
+  tm->cb(rctx, tm->privdata);
+
+  // If needed - free the thread safe context.
+  // It's up to the user to decide whether automemory is active there
+  if (rctx) RedisModule_FreeThreadSafeContext(rctx);
+}
+
+static void *rmutilTimer_Loop(void *ctx) {
+  RMUtilTimer *tm = ctx;
+  struct timespec now, armAt, sleptUntil = {0, 0};
+  int periodic = tm->interval.tv_sec || tm->interval.tv_nsec;
+
+  pthread_mutex_lock(&tm->lock);
+  while (!tm->terminated) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!tm->hasDeadline) {
+      // parked
+      sleptUntil = (struct timespec){0, 0};
+      rmutilTimer_Wait(tm);
+      continue;
     }
-    if (rc == EINVAL) {
-      perror("Error waiting for condition");
-      break;
+
+    armAt = rmutilTimer_ArmTime(tm);
+    if (timespecBefore(&now, &armAt)) {
+      // not due yet, or woken early by a nearer deadline or termination
+      sleptUntil = armAt;
+      rmutilTimer_Wait(tm);
+      continue;
+    }
+    // only a sleep that ran its course tells how much the thread oversleeps
+    if (armAt.tv_sec == sleptUntil.tv_sec && armAt.tv_nsec == sleptUntil.tv_nsec) {
+      rmutilTimer_Sample(tm, timespecDiffNs(&now, &armAt));
     }
+    sleptUntil = (struct timespec){0, 0};
+
+    if (timespecBefore(&now, &tm->wakeAt)) {
+      // woke up early on purpose, spin the rest of the way without our lock held
+      struct timespec wakeAt = tm->wakeAt;
+      pthread_mutex_unlock(&tm->lock);
+      rmutilTimer_SpinUntil(&wakeAt);
+      pthread_mutex_lock(&tm->lock);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (tm->terminated) break;
+    }
+
+    // how late did we wake up
+    long long latency = timespecDiffNs(&now, &tm->wakeAt);
+    tm->stats.runs++;
+    tm->stats.lastLatencyNs = latency;
+    tm->stats.totalLatencyNs += latency;
+    if (latency > tm->stats.maxLatencyNs) tm->stats.maxLatencyNs = latency;
+    tm->stats.earlyWakeNs = timespecDiffNs(&tm->wakeAt, &armAt);
+
+    if (periodic) {
+      // ticks missed while running late are skipped
+      tm->wakeAt = timespecAdd(&tm->wakeAt, &tm->interval);
+      if (timespecBefore(&tm->wakeAt, &now)) tm->wakeAt = timespecAdd(&now, &tm->interval);
+      rmutilTimer_Arm(tm);
+    } else {
+      // the callback sets the next deadline
+      tm->hasDeadline = 0;
+    }
+
+    // run without our lock held, so the callback can re-arm the timer
+    pthread_mutex_unlock(&tm->lock);
+    rmutilTimer_Run(tm);
+    pthread_mutex_lock(&tm->lock);
   }
+  pthread_mutex_unlock(&tm->lock);
 
   // call the termination callback if needed
   if (tm->onTerm != NULL) {
@@ -58,30 +260,109 @@ static void *rmutilTimer_Loop(void *ctx) {
   }
 
   // free resources associated with the timer
-  pthread_cond_destroy(&tm->cond);
+  rmutilTimer_FreeWait(tm);
+  pthread_mutex_destroy(&tm->lock);
   free(tm);
 
   return NULL;
 }
 
-/* set a new frequency for the timer. This will take effect AFTER the next trigger */
-void RMUtilTimer_SetInterval(struct RMUtilTimer *t, struct timespec newInterval) {
-  t->interval = newInterval;
-}
-
-RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
-                                     void *privdata, struct timespec interval) {
+static RMUtilTimer *rmutilTimer_New(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                    void *privdata, struct timespec interval) {
   RMUtilTimer *ret = malloc(sizeof(*ret));
+  if (!ret) return NULL;
   *ret = (RMUtilTimer){
       .privdata = privdata, .interval = interval, .cb = cb, .onTerm = onTerm,
   };
-  pthread_cond_init(&ret->cond, NULL);
+  if (rmutilTimer_InitWait(ret) != 0) {
+    free(ret);
+    return NULL;
+  }
   pthread_mutex_init(&ret->lock, NULL);
 
+  if (interval.tv_sec || interval.tv_nsec) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ret->wakeAt = timespecAdd(&now, &interval);
+    ret->hasDeadline = 1;
+    rmutilTimer_Arm(ret);
+  }
+
+  // nobody joins the thread, it frees the timer on its way out
   pthread_create(&ret->thread, NULL, rmutilTimer_Loop, ret);
+  pthread_detach(ret->thread);
   return ret;
 }
 
+/* set a new frequency for the timer, counting from now */
+void RMUtilTimer_SetInterval(struct RMUtilTimer *t, struct timespec newInterval) {
+  struct timespec now;
+
+  pthread_mutex_lock(&t->lock);
+  t->interval = newInterval;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  t->wakeAt = timespecAdd(&now, &newInterval);
+  t->hasDeadline = 1;
+  rmutilTimer_Arm(t);
+  pthread_mutex_unlock(&t->lock);
+}
+
+RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                     void *privdata, struct timespec interval) {
+  return rmutilTimer_New(cb, onTerm, privdata, interval);
+}
+
+RMUtilTimer *RMUtil_NewDeadlineTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                     void *privdata) {
+  return rmutilTimer_New(cb, onTerm, privdata, (struct timespec){0, 0});
+}
+
+void RMUtilTimer_WakeAt(struct RMUtilTimer *t, struct timespec at) {
+  pthread_mutex_lock(&t->lock);
+  if (!t->hasDeadline || timespecBefore(&at, &t->wakeAt)) {
+    t->wakeAt = at;
+    t->hasDeadline = 1;
+    rmutilTimer_Arm(t);
+  }
+  pthread_mutex_unlock(&t->lock);
+}
+
+void RMUtilTimer_SetSpin(struct RMUtilTimer *t, long long maxSpinNs) {
+  pthread_mutex_lock(&t->lock);
+  t->maxSpinNs = maxSpinNs > 0 ? maxSpinNs : 0;
+  if (t->hasDeadline) rmutilTimer_Arm(t);
+  pthread_mutex_unlock(&t->lock);
+}
+
+int RMUtilTimer_SetScheduling(struct RMUtilTimer *t, int policy, int priority) {
+  struct sched_param param = {.sched_priority = priority};
+  return pthread_setschedparam(t->thread, policy, &param);
+}
+
+int RMUtilTimer_SetAffinity(struct RMUtilTimer *t, const int *cpus, int ncpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < ncpus; i++) {
+    if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) return EINVAL;
+    CPU_SET(cpus[i], &set);
+  }
+  return pthread_setaffinity_np(t->thread, sizeof(set), &set);
+#else
+  return ENOTSUP;
+#endif
+}
+
+void RMUtilTimer_GetStats(struct RMUtilTimer *t, RMUtilTimerStats *stats) {
+  pthread_mutex_lock(&t->lock);
+  *stats = t->stats;
+  pthread_mutex_unlock(&t->lock);
+}
+
 int RMUtilTimer_Terminate(struct RMUtilTimer *t) {
-  return pthread_cond_signal(&t->cond);
+  pthread_mutex_lock(&t->lock);
+  t->terminated = 1;
+  rmutilTimer_Signal(t);
+  pthread_mutex_unlock(&t->lock);
+  return 0;
 }
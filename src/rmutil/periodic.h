@@ -15,14 +15,58 @@ typedef void (*RMutilTimerFunc)(RedisModuleCtx *ctx, void *privdata);
 
 typedef void (*RMUtilTimerTerminationFunc)(void *privdata);
 
+/* RMUtilTimerStats - how late the timer's thread woke up to run its callback, in nanoseconds on
+ * CLOCK_MONOTONIC, and how early it last woke up to spin */
+typedef struct RMUtilTimerStats {
+  unsigned long long runs;
+  long long lastLatencyNs;
+  long long maxLatencyNs;
+  long long totalLatencyNs;
+  long long earlyWakeNs;
+} RMUtilTimerStats;
+
 /* Create and start a new periodic timer. Each timer has its own thread and can only be run and
- * stopped once. The timer runs `cb` every `interval` with `privdata` passed to the callback. */
+ * stopped once. The timer runs `cb` every `interval` with `privdata` passed to the callback.
+ * Timers sleep on CLOCK_MONOTONIC, with a timerfd on Linux, so wall clock jumps do not affect them.
+ * @return the timer; NULL on failure */
 struct RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
                                             void *privdata, struct timespec interval);
 
-/* set a new frequency for the timer. This will take effect AFTER the next trigger */
+/* set a new frequency for the timer. The next trigger is rescheduled right away, `newInterval`
+ * from now */
 void RMUtilTimer_SetInterval(struct RMUtilTimer *t, struct timespec newInterval);
 
+/* Create and start a new deadline timer. Rather than running `cb` every interval, the timer's
+ * thread sleeps until the deadline set by RMUtilTimer_WakeAt, runs `cb` once, and parks until a
+ * new deadline is set, so it uses no CPU while there is nothing to run. The deadline is cleared
+ * before `cb` runs, so `cb` sets the next one. */
+struct RMUtilTimer *RMUtil_NewDeadlineTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                            void *privdata);
+
+/* Run a deadline timer's callback at `at`, an absolute CLOCK_MONOTONIC time, unless it is already
+ * set to run earlier. Can be called from any thread; moving the deadline earlier re-arms the timer
+ * right away, with a single syscall on Linux. */
+void RMUtilTimer_WakeAt(struct RMUtilTimer *t, struct timespec at);
+
+/* Let the timer spin for up to `maxSpinNs` before running its callback, 0 (the default) to never
+ * spin. The timer learns by how much its thread oversleeps (the p99 of every 100 wakeups, smoothed
+ * over time), wakes up that much ahead of time, bounded by `maxSpinNs`, and spins on the clock the
+ * rest of the way, trading that CPU time for running closer to the deadline. */
+void RMUtilTimer_SetSpin(struct RMUtilTimer *t, long long maxSpinNs);
+
+/* Run the timer's thread under a scheduling policy (e.g. SCHED_FIFO or SCHED_RR) at a priority,
+ * as with pthread_setschedparam. Real-time policies need privileges (CAP_SYS_NICE or an
+ * RLIMIT_RTPRIO), the thread keeps its policy if they are missing.
+ * @return 0 on success; an errno value on failure */
+int RMUtilTimer_SetScheduling(struct RMUtilTimer *t, int policy, int priority);
+
+/* Pin the timer's thread to the given CPUs.
+ * @return 0 on success; an errno value on failure, ENOTSUP where threads can not be pinned */
+int RMUtilTimer_SetAffinity(struct RMUtilTimer *t, const int *cpus, int ncpus);
+
+/* Copy the timer's wake up latency stats into `stats` */
+void RMUtilTimer_GetStats(struct RMUtilTimer *t, RMUtilTimerStats *stats);
+
 /* Stop the timer loop, call the termination callbck to free up any resources linked to the timer,
  * and free the timer after stopping.
  *
@@ -5,6 +5,12 @@
 #include "rmutil/strings.h"
 #include "rmutil/periodic.h"
 #include "util/millisecond_time.h"
+#include "util/mpsc_queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #define REDIS_MODULE_TARGET
 #include "util/rmalloc.h"
@@ -18,14 +24,95 @@ int profiling_array[PROFILE_STORE_SIZE];
 #endif
 
 #define RTEXP_BUFFER_MS 1
-#define RTEXP_MIN_INTERVAL_NS 100 // =0.1 microsecond (10^-6 second) scale. 
-                                  //      Existing Expire is on milliseconds (10^-3 second) scale
-#define RTEXP_MAX_INTERVAL_NS 900000 // = 0.9 millisecond (0.0009 second) scale
+#define RTEXP_DRAIN_BATCH 256 // due expirations popped from the store at a time
+#define RTEXP_MAX_SPIN_US 1000 // the timer never spins for longer than a millisecond
+#define RTEXP_MAX_CPUS 1024 // CPUs the timer thread can be pinned to
+#define RTEXP_TICK_KEYS 10000 // default budget of a tick, after which it lets clients run
+#define RTEXP_TICK_US 1000
+#define RTEXP_MIN_YIELD_US 100 // clients get at least this long between the ticks of a backlog
+#define RTEXP_QUEUE_SIZE 16384 // commands waiting for the timer thread to apply them
+#define RTEXP_READ_DRAIN RTEXP_DRAIN_BATCH // most queued commands a reading command applies
+
+#define RTEXP_OP_SCHEDULE 0
+#define RTEXP_OP_CANCEL 1
+#define RTEXP_OP_RENAME 2
+
+// a change to the store, queued by a command for the timer thread to apply
+typedef struct {
+  int type;
+  size_t len;
+  mstime_t at_ms;            // the key's expiration datetime, when scheduled
+  char *long_key;            // a copy of a key too long to be inlined, NULL for short keys
+  char inline_key[RTX_INLINE_KEY_LEN + 1];
+  char *new_key;             // a copy of the key's new name, when renamed
+  size_t new_len;
+} RTEXPOp;
 
 static RTXStore *rtxStore;
-static struct RMUtilTimer *interval_timer;
+// commands never change the store themselves, they queue their changes for the timer thread
+static mpsc_queue_t *commands;
+// guards the store, and makes its holder the queue's consumer. Taken by the timer thread without
+// the redis lock, so it can apply the queue and look for due keys while clients run, and by the
+// few commands reading the store
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+// sleeps until the earliest expiration, parked while the store is empty
+static struct RMUtilTimer *expiration_timer;
+// TIMER eventloop: the one timer of redis' event loop set for the earliest expiration instead
+static RedisModuleTimerID loop_timer;
+static int loop_timer_armed;
+static long long loop_wake_at_ns;  // when it was meant to fire, on the monotonic clock
+static RMUtilTimerStats loop_stats;
+// when the timer thread is set to wake up, -1 while parked. Guarded by the redis lock
+static mstime_t wake_at_ms = -1;
+
+// the keys claimed by the timer to be expired, with their versions when claimed. Kept across
+// ticks, as a tick that runs out of time leaves the rest to the next one
+static struct {
+  RTXElementNode **nodes;
+  int *versions;
+  size_t count;
+  size_t size;
+} claimed;
+
+// how the timer thread is run, from the module's load arguments
+typedef struct {
+  int event_loop;       // expire from redis' event loop rather than from a thread of our own
+  long long spin_us;
+  int policy;           // -1 to keep the default scheduling policy
+  long long priority;
+  int cpus[RTEXP_MAX_CPUS];
+  int ncpus;            // 0 to run on any CPU
+  int mlock;
+  long long tick_keys;  // the most keys a tick expires holding the redis lock, 0 for no limit
+  long long tick_us;    // the longest a tick holds the redis lock, 0 for no limit
+} RTEXPTimerArgs;
+
+static RTEXPTimerArgs timer_args = {
+    .policy = -1, .tick_keys = RTEXP_TICK_KEYS, .tick_us = RTEXP_TICK_US};
+
+// what the ticks expired, and how many of them ran out of budget with keys still due
+static struct {
+  long long expired;
+  long long overruns;
+  mstime_t backlog_ms;  // how late the oldest key still due was after the last tick
+} tick_stats;
+// a tick ran out of budget, the next one is already scheduled
+static int in_backlog;
+// the timer is unlinking keys itself, their keyspace events are not the clients'
+static int unlinking;
+// at least as many as the expirations in the store and queued for it, so keyspace events can be
+// ignored while there are none. Guarded by the redis lock: counted up as commands queue new
+// expirations, and set to the store's own count whenever both locks are held with the queue
+// applied, since nothing is queued without the redis lock
+static size_t tracked;
+// the store's count of expirations, published by every holder of the store's lock that changed it
+static size_t published_count;
+// the name of the key being renamed, between its rename_from and rename_to events
+static struct {
+  char *key;
+  size_t len;
+} renaming;
 
-typedef long long nstime_t;
 /************************
  *    Module Utils
  ************************/
@@ -45,71 +132,311 @@ int redisSetPExpiration(RedisModuleCtx *ctx, RedisModuleString *key_str, mstime_
   return res;
 }
 
-nstime_t to_ns(mstime_t ms) {
-  return ms * 1000000;
+long long monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void setNextTimerInterval(mstime_t interval_ms){
-  nstime_t interval_ns = to_ns(interval_ms);
-  nstime_t new_interval_ns = (interval_ns < RTEXP_MAX_INTERVAL_NS)? interval_ms : RTEXP_MAX_INTERVAL_NS;
-  new_interval_ns = new_interval_ns / 2; // Safety buffer - asimptotically get closet to the timeout
-  
-  RMUtilTimer_SetInterval(interval_timer, 
-    (struct timespec){
-    .tv_sec = 0,
-    .tv_nsec = new_interval_ns});
+long long monotonic_us(void) {
+  return monotonic_ns() / 1000;
 }
 
-void timerCb(RedisModuleCtx *ctx, void *p) {
-  RedisModule_ThreadSafeContextLock(ctx);
+void eventLoopTimerCb(RedisModuleCtx *ctx, void *p);
 
-  mstime_t now = rm_current_time_ms();
-  nstime_t now_ns = to_ns(now);
+/*
+ * Wake the timer thread wait_ns from now, unless it is already set to wake up earlier.
+ * With TIMER eventloop, set redis' event loop to expire the keys then instead.
+ */
+void scheduleWakeupIn(RedisModuleCtx *ctx, long long wait_ns) {
+  if (timer_args.event_loop) {
+    if (wait_ns < 0) wait_ns = 0;
+    if (loop_timer_armed) RedisModule_StopTimer(ctx, loop_timer, NULL);
+    // event loop timers count whole milliseconds, rounded up so the keys are due when it fires
+    loop_timer = RedisModule_CreateTimer(ctx, (wait_ns + 999999) / 1000000, eventLoopTimerCb, NULL);
+    loop_timer_armed = 1;
+    loop_wake_at_ns = monotonic_ns() + wait_ns;
+    return;
+  }
+
+  struct timespec at;
+  clock_gettime(CLOCK_MONOTONIC, &at);
+  if (wait_ns > 0) {
+    at.tv_sec += wait_ns / 1000000000;
+    at.tv_nsec += wait_ns % 1000000000;
+    if (at.tv_nsec >= 1000000000) {
+      at.tv_sec++;
+      at.tv_nsec -= 1000000000;
+    }
+  }
+  RMUtilTimer_WakeAt(expiration_timer, at);
+}
+
+/*
+ * Wake the timer thread at the given expiration datetime, unless it is already set to wake up
+ * earlier. Datetimes are wall clock milliseconds, while the timer sleeps on the monotonic clock,
+ * so the wait is measured to the nanosecond to wake up right as the millisecond begins.
+ */
+void scheduleWakeup(RedisModuleCtx *ctx, mstime_t at_ms) {
+  if (at_ms < 0) return; // nothing to expire, let the timer park
+  // keys are already overdue, and the next tick is set to let clients run first
+  if (in_backlog) return;
+  // already set to wake up by then, which spares most commands the timer's own lock
+  if (wake_at_ms >= 0 && wake_at_ms <= at_ms) return;
+  wake_at_ms = at_ms;
+
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  scheduleWakeupIn(ctx, (at_ms - wall.tv_sec * 1000LL) * 1000000 - wall.tv_nsec);
+}
+
+/*
+ * @return whether a tick that started at started_us and expired that many keys is out of budget
+ */
+int tickBudgetSpent(long long started_us, long long expired) {
+  return (timer_args.tick_keys > 0 && expired >= timer_args.tick_keys) ||
+         (timer_args.tick_us > 0 && monotonic_us() - started_us >= timer_args.tick_us);
+}
+
+// must be called holding both locks; the store's count is only exact with the queue applied
+static inline void syncTracked(void) {
+  if (mpsc_count(commands) == 0) tracked = expiration_count(rtxStore);
+}
+
+static inline void publishCount(void) {
+  __atomic_store_n(&published_count, expiration_count(rtxStore), __ATOMIC_RELAXED);
+}
+
+static inline char *opKey(RTEXPOp *op) {
+  return op->long_key ? op->long_key : op->inline_key;
+}
+
+/*
+ * Apply up to max of the queued commands to the store, all of them for 0, new expirations a batch
+ * at a time. Must be called holding the store's lock.
+ */
+void applyOps(size_t max) {
+  static RTEXPOp ops[RTEXP_DRAIN_BATCH];
+  static char *keys[RTEXP_DRAIN_BATCH];
+  static size_t lens[RTEXP_DRAIN_BATCH];
+  static mstime_t ats[RTEXP_DRAIN_BATCH];
+  RTEXPOp op;
+  size_t n = 0, i, applied = 0;
+  int popped;
+  do {
+    popped = (max == 0 || applied++ < max) && mpsc_pop(commands, &op) == 0;
+    if (popped && op.type == RTEXP_OP_SCHEDULE) {
+      ops[n] = op;
+      keys[n] = opKey(&ops[n]);
+      lens[n] = op.len;
+      ats[n] = op.at_ms;
+      if (++n < RTEXP_DRAIN_BATCH) continue;
+    }
+    // a cancel, a full batch or the end of the queue: store the expirations gathered so far
+    if (n > 0) {
+      set_element_exp_batch_at(rtxStore, keys, lens, ats, n);
+      for (i = 0; i < n; ++i) RedisModule_Free(ops[i].long_key);
+      n = 0;
+    }
+    if (popped && op.type == RTEXP_OP_CANCEL) {
+      del_element_exp_len(rtxStore, opKey(&op), op.len);
+      RedisModule_Free(op.long_key);
+    }
+    if (popped && op.type == RTEXP_OP_RENAME) {
+      rename_element_exp(rtxStore, opKey(&op), op.len, op.new_key, op.new_len);
+      RedisModule_Free(op.long_key);
+      RedisModule_Free(op.new_key);
+    }
+  } while (popped);
+  publishCount();
+}
+
+static void initOp(RTEXPOp *op, int type, const char *key, size_t len, mstime_t at_ms) {
+  *op = (RTEXPOp){.type = type, .len = len, .at_ms = at_ms, .long_key = NULL, .new_key = NULL};
+  char *copy = op->inline_key;
+  if (len > RTX_INLINE_KEY_LEN) copy = op->long_key = RedisModule_Alloc(len + 1);
+  memcpy(copy, key, len);
+  copy[len] = '\0';
+}
+
+/*
+ * Queue a change to the store for the timer thread, waking it up to apply the queue once the
+ * queue is half full. Should the queue fill up regardless, the caller applies a batch of it.
+ */
+void pushOp(RedisModuleCtx *ctx, RTEXPOp *op) {
+  while (mpsc_push(commands, op) != 0) {
+    pthread_mutex_lock(&store_lock);
+    applyOps(RTEXP_DRAIN_BATCH);
+    syncTracked();
+    pthread_mutex_unlock(&store_lock);
+  }
+  if (mpsc_count(commands) >= RTEXP_QUEUE_SIZE / 2) scheduleWakeup(ctx, rm_current_time_ms());
+}
+
+void enqueueOp(RedisModuleCtx *ctx, int type, const char *key, size_t len, mstime_t at_ms) {
+  RTEXPOp op;
+  initOp(&op, type, key, len, at_ms);
+  if (type == RTEXP_OP_SCHEDULE) tracked++;
+  pushOp(ctx, &op);
+}
+
+// queue moving the expiration of key to new_key
+void enqueueRename(RedisModuleCtx *ctx, const char *key, size_t len, const char *new_key,
+                   size_t new_len) {
+  RTEXPOp op;
+  initOp(&op, RTEXP_OP_RENAME, key, len, -1);
+  op.new_key = RedisModule_Alloc(new_len + 1);
+  memcpy(op.new_key, new_key, new_len);
+  op.new_key[new_len] = '\0';
+  op.new_len = new_len;
+  pushOp(ctx, &op);
+}
 
-  mstime_t next = next_at(rtxStore);
-  while (next > 0 && to_ns(next) < (now_ns+RTEXP_MIN_INTERVAL_NS)) {
-    RTXElementNode* node = pop_next(rtxStore);    
-    if (node != NULL) {
+/*
+ * Claim the keys due by now, up to the tick's key budget, a batch at a time under the store's
+ * lock, so clients are never held up for more than a batch.
+ */
+void claimDue(mstime_t now) {
+  size_t want, got;
+  do {
+    want = RTEXP_DRAIN_BATCH;
+    if (timer_args.tick_keys > 0) {
+      if (claimed.count >= (size_t)timer_args.tick_keys) return;
+      if (timer_args.tick_keys - claimed.count < want) want = timer_args.tick_keys - claimed.count;
+    }
+    if (claimed.count + want > claimed.size) {
+      claimed.size = claimed.size ? claimed.size * 2 : RTEXP_DRAIN_BATCH;
+      claimed.nodes = RedisModule_Realloc(claimed.nodes, claimed.size * sizeof(RTXElementNode *));
+      claimed.versions = RedisModule_Realloc(claimed.versions, claimed.size * sizeof(int));
+    }
+    pthread_mutex_lock(&store_lock);
+    applyOps(0);
+    got = claim_due(rtxStore, now, claimed.nodes + claimed.count, claimed.versions + claimed.count,
+                    want);
+    pthread_mutex_unlock(&store_lock);
+    claimed.count += got;
+  } while (got == want);
+}
+
+/*
+ * Expire the claimed keys and set up the next tick. Must be called holding the redis lock.
+ */
+void expireClaimed(RedisModuleCtx *ctx, mstime_t now) {
+  pthread_mutex_lock(&store_lock);
+  in_backlog = 0;
+  wake_at_ms = -1;
+  // commands are queued holding the redis lock, so this catches up with all of them, and keys
+  // refreshed or removed since they were claimed are not expired
+  applyOps(0);
+  long long started_us = monotonic_us();
+  size_t i, expired = 0;
+  unlinking = 1;
+  for (i = 0; i < claimed.count; ++i) {
+    if (i % RTEXP_DRAIN_BATCH == 0 && i > 0 && tickBudgetSpent(started_us, expired)) break;
+    RTXElementNode* node = claimed.nodes[i];
+    // clients may have refreshed or removed the key since it was claimed
+    if (expire_claimed(rtxStore, node, claimed.versions[i]) == RTXS_OK) {
       RedisModuleString *key_str = RedisModule_CreateString(ctx, node->key, node->len);
       RedisModuleKey *key = RedisModule_OpenKey(ctx, key_str, REDISMODULE_READ | REDISMODULE_WRITE);
       RedisModule_UnlinkKey(key);
       RedisModule_CloseKey(key);
-      
+      RedisModule_FreeString(ctx, key_str);
+      expired++;
+
       #ifdef PROFILE_GRANULARITY
       if (profile_timer_count % PROFILE_GRANULARITY == 0) {
-        mstime_t profile_slot = abs(next-rm_current_time_ms());
+        mstime_t profile_slot = abs(node->exp.time-rm_current_time_ms());
         profile_slot = fmax(0,profile_slot);
         profile_slot = fmin(profile_slot,PROFILE_STORE_SIZE);
         profiling_array[profile_slot] += 1;
       }
       profile_timer_count += 1;
       #endif
-      freeRTXElementNode(node);
     }
-    next = next_at(rtxStore);
+    freeRTXElementNode(node);
   }
-  if (next < 0)
-    setNextTimerInterval(RTEXP_MAX_INTERVAL_NS);
-  else
-    setNextTimerInterval(next);
+  unlinking = 0;
+  publishCount();
+  syncTracked();
+  tick_stats.expired += expired;
+
+  // out of time, the keys left are carried over to the next tick
+  claimed.count -= i;
+  memmove(claimed.nodes, claimed.nodes + i, claimed.count * sizeof(RTXElementNode *));
+  memmove(claimed.versions, claimed.versions + i, claimed.count * sizeof(int));
+
+  mstime_t next = claimed.count ? claimed.nodes[0]->exp.time : next_at(rtxStore);
+  if (claimed.count || (next >= 0 && next <= now)) {
+    // out of budget: let clients run for as long as we held the lock, and carry on from there
+    long long held_us = monotonic_us() - started_us;
+    tick_stats.overruns++;
+    tick_stats.backlog_ms = next <= now ? rm_current_time_ms() - next : 0;
+    scheduleWakeupIn(ctx, (held_us > RTEXP_MIN_YIELD_US ? held_us : RTEXP_MIN_YIELD_US) * 1000);
+    in_backlog = 1;
+  } else {
+    tick_stats.backlog_ms = 0;
+    scheduleWakeup(ctx, next);
+  }
+  pthread_mutex_unlock(&store_lock);
+}
+
+void timerCb(RedisModuleCtx *ctx, void *p) {
+  mstime_t now = rm_current_time_ms();
+  // apply the queued commands and find the due keys before taking the redis lock, which is then
+  // held only to unlink them
+  claimDue(now);
+
+  RedisModule_ThreadSafeContextLock(ctx);
+  expireClaimed(ctx, now);
   RedisModule_ThreadSafeContextUnlock(ctx);
 }
 
+// TIMER eventloop: run by redis' event loop on its own thread, no lock to hand over
+void eventLoopTimerCb(RedisModuleCtx *ctx, void *p) {
+  long long latency = monotonic_ns() - loop_wake_at_ns;
+  loop_timer_armed = 0;
+  loop_stats.runs++;
+  loop_stats.lastLatencyNs = latency;
+  loop_stats.totalLatencyNs += latency;
+  if (latency > loop_stats.maxLatencyNs) loop_stats.maxLatencyNs = latency;
+
+  mstime_t now = rm_current_time_ms();
+  claimDue(now);
+  expireClaimed(ctx, now);
+}
+
 /********************
  *    DS Binding
  ********************/
 
-int set_ttl(RTXStore *store, char *element_key, size_t len, mstime_t ttl_ms) {
-  setNextTimerInterval(ttl_ms);
-  return set_element_exp(store, element_key, len, ttl_ms);
+int set_ttl(RedisModuleCtx *ctx, const char *element_key, size_t len, mstime_t ttl_ms,
+            mstime_t precision_ms) {
+  // the deadline is set now, however long the command waits in the queue
+  mstime_t at_ms = expiration_deadline(rm_current_time_ms(), ttl_ms, precision_ms);
+  enqueueOp(ctx, RTEXP_OP_SCHEDULE, element_key, len, at_ms);
+  // the timer thread is only woken if this key may now be the first to expire
+  scheduleWakeup(ctx, at_ms);
+  return REDISMODULE_OK;
 }
 
-int remove_expiration(RTXStore *store, char *element_key) {
-  return del_element_exp(store, element_key);
+int remove_expiration(RedisModuleCtx *ctx, const char *element_key, size_t len) {
+  enqueueOp(ctx, RTEXP_OP_CANCEL, element_key, len, -1);
+  return REDISMODULE_OK;
 }
 
-mstime_t get_ttl(RTXStore *store, char *element_key) {
+/*
+ * Read a key's expiration, after applying a bounded batch of the queue so a client sees the
+ * expirations it has just set. Should more be queued, the timer thread is woken up to apply the
+ * rest, and the expiration read may predate the last of them.
+ */
+mstime_t get_ttl(RedisModuleCtx *ctx, RTXStore *store, char *element_key) {
+  pthread_mutex_lock(&store_lock);
+  applyOps(RTEXP_READ_DRAIN);
+  syncTracked();
   mstime_t timestamp_ms = get_element_exp(store, element_key);
+  int behind = mpsc_count(commands) > 0;
+  pthread_mutex_unlock(&store_lock);
+  if (behind) scheduleWakeup(ctx, rm_current_time_ms());
   if (timestamp_ms != -1) {
     mstime_t now = rm_current_time_ms();
     return timestamp_ms - now;
@@ -117,13 +444,62 @@ mstime_t get_ttl(RTXStore *store, char *element_key) {
   return -2; // to conform with redis' PTTL
 }
 
+/*
+ * Read the optional PRECISION {ms} following a command's own arguments, at argv[offset].
+ * Without it the store's default precision is used.
+ * @return REDISMODULE_OK, or REDISMODULE_ERR after replying with an error
+ */
+int parsePrecision(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int offset,
+                   mstime_t *precision_ms) {
+  *precision_ms = rtxStore->precision_ms;
+  if (argc <= offset) return REDISMODULE_OK;
+
+  if (argc != offset + 2 ||
+      strcasecmp(RedisModule_StringPtrLen(argv[offset], NULL), "PRECISION") != 0 ||
+      RedisModule_StringToLongLong(argv[offset + 1], precision_ms) == REDISMODULE_ERR ||
+      *precision_ms <= 0) {
+    RedisModule_ReplyWithError(ctx, "PRECISION must be a positive number of milliseconds");
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+/*
+ * Keep the store in line with what clients do to the keys behind its back: a key deleted,
+ * overwritten, evicted, moved to another database or expired by redis itself has its expiration
+ * dropped, and a renamed key takes its expiration along to its new name. Flushed and swapped
+ * databases raise no event per key and are not followed.
+ */
+int keyspaceEventCb(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key) {
+  // plain SET and DEL traffic costs nothing while no key has an expiration
+  if (unlinking || !rtxStore || tracked == 0) return REDISMODULE_OK;
+
+  size_t len;
+  const char *element_key = RedisModule_StringPtrLen(key, &len);
+  if (!strcmp(event, "del") || !strcmp(event, "set") || !strcmp(event, "expired") ||
+      !strcmp(event, "evicted") || !strcmp(event, "move_from")) {
+    enqueueOp(ctx, RTEXP_OP_CANCEL, element_key, len, -1);
+  } else if (!strcmp(event, "rename_from")) {
+    // always followed by rename_to, in the same command
+    RedisModule_Free(renaming.key);
+    renaming.key = RedisModule_Alloc(len);
+    memcpy(renaming.key, element_key, len);
+    renaming.len = len;
+  } else if (!strcmp(event, "rename_to") && renaming.key) {
+    enqueueRename(ctx, renaming.key, renaming.len, element_key, len);
+    RedisModule_Free(renaming.key);
+    renaming.key = NULL;
+  }
+  return REDISMODULE_OK;
+}
+
 /************************
  *    Module Commands
  ************************/
 
-// 1. REXPIRE {key} {ttl_ms}
+// 1. REXPIRE {key} {ttl_ms} [PRECISION {ms}]
 int ExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  if (argc != 3) RedisModule_WrongArity(ctx);
+  if (argc != 3 && argc != 5) return RedisModule_WrongArity(ctx);
 
   if (!rtxStore) {
     RedisModule_ReplyWithError(ctx, "Store was not initialized");
@@ -139,14 +515,19 @@ int ExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_ReplyWithError(ctx, "Timestamp must be parsable to type Long Long");
     return REDISMODULE_ERR;
   }
+  mstime_t precision_ms;
+  if (parsePrecision(ctx, argv, argc, 3, &precision_ms) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
 
-  if (redisSetPExpiration(ctx, argv[1], ttl_ms) == REDISMODULE_ERR){
+  // redis must not expire the key before our deadline, rounded up by up to precision_ms - 1
+  if (redisSetPExpiration(ctx, argv[1], ttl_ms + precision_ms - 1) == REDISMODULE_ERR){
     RedisModule_ReplyWithLongLong(ctx, 1);
     return REDISMODULE_ERR;
   }
 
   // THE ACTUAL EXPIRATION 
-  if (set_ttl(rtxStore, element_key, element_key_len, ttl_ms) == REDISMODULE_OK) {
+  if (set_ttl(ctx, element_key, element_key_len, ttl_ms, precision_ms) == REDISMODULE_OK) {
     RedisModule_ReplyWithLongLong(ctx, 0);
     return REDISMODULE_OK;
   } else {
@@ -155,9 +536,9 @@ int ExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   }
 }
 
-// 2. REXPIREAT {key} {timestamp_ms}
+// 2. REXPIREAT {key} {timestamp_ms} [PRECISION {ms}]
 int ExpireAtCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  if (argc != 3) RedisModule_WrongArity(ctx);
+  if (argc != 3 && argc != 5) return RedisModule_WrongArity(ctx);
 
   if (!rtxStore) {
     RedisModule_ReplyWithError(ctx, "Store was not initialized");
@@ -179,13 +560,17 @@ int ExpireAtCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_ReplyWithError(ctx, "Expiration time must be in the future");
     return REDISMODULE_ERR;
   }
+  mstime_t precision_ms;
+  if (parsePrecision(ctx, argv, argc, 3, &precision_ms) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
 
-  if (redisSetPExpiration(ctx, argv[1], ttl_ms) == REDISMODULE_ERR){
+  if (redisSetPExpiration(ctx, argv[1], ttl_ms + precision_ms - 1) == REDISMODULE_ERR){
     RedisModule_ReplyWithLongLong(ctx, 1);
     return REDISMODULE_ERR;
   }
 
-  if (set_ttl(rtxStore, element_key, element_key_len, ttl_ms) == REDISMODULE_OK) {
+  if (set_ttl(ctx, element_key, element_key_len, ttl_ms, precision_ms) == REDISMODULE_OK) {
     RedisModule_ReplyWithLongLong(ctx, 0);
     return REDISMODULE_OK;
   } else {
@@ -206,7 +591,7 @@ int TTLCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   size_t element_key_len;
   const char * element_key = RedisModule_StringPtrLen(argv[1], &element_key_len);
 
-  mstime_t stored_ttl = get_ttl(rtxStore, element_key);
+  mstime_t stored_ttl = get_ttl(ctx, rtxStore, element_key);
   RedisModule_ReplyWithLongLong(ctx, stored_ttl);
   if (stored_ttl == -1)
     return REDISMODULE_ERR;
@@ -231,14 +616,14 @@ int UnexpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_ERR;
   }
 
-  remove_expiration(rtxStore, element_key);
+  remove_expiration(ctx, element_key, element_key_len);
   RedisModule_ReplyWithLongLong(ctx, 0);
   return REDISMODULE_OK;
 }
 
-// 5. RSETEX {key} {value} {ttl}
+// 5. RSETEX {key} {value} {ttl} [PRECISION {ms}]
 int SetexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  if (argc != 4) RedisModule_WrongArity(ctx);
+  if (argc != 4 && argc != 6) return RedisModule_WrongArity(ctx);
   
   if (!rtxStore) {
     RedisModule_ReplyWithError(ctx, "Store was not initialized");
@@ -260,17 +645,21 @@ int SetexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_ReplyWithError(ctx, "Expiration time must be in the future");
     return REDISMODULE_ERR;
   }
+  mstime_t precision_ms;
+  if (parsePrecision(ctx, argv, argc, 4, &precision_ms) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
   
   RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
   RedisModule_StringSet(key, argv[2]);
   RedisModule_CloseKey(key);
   
-  if (redisSetPExpiration(ctx, argv[1], ttl_ms) == REDISMODULE_ERR){
+  if (redisSetPExpiration(ctx, argv[1], ttl_ms + precision_ms - 1) == REDISMODULE_ERR){
     RedisModule_ReplyWithLongLong(ctx, 1);
     return REDISMODULE_ERR;
   }
 
-  if (set_ttl(rtxStore, element_key, element_key_len, ttl_ms) == REDISMODULE_OK) {
+  if (set_ttl(ctx, element_key, element_key_len, ttl_ms, precision_ms) == REDISMODULE_OK) {
     RedisModule_ReplyWithLongLong(ctx, 0);
     return REDISMODULE_OK;
   } else {
@@ -315,13 +704,14 @@ int ExecuteAndExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
   size_t element_key_len;
   const char * element_key = RedisModule_StringPtrLen(element_key_str, &element_key_len);
 
-  if (redisSetPExpiration(ctx, element_key_str, ttl_ms) == REDISMODULE_ERR){
+  mstime_t precision_ms = rtxStore->precision_ms;
+  if (redisSetPExpiration(ctx, element_key_str, ttl_ms + precision_ms - 1) == REDISMODULE_ERR){
     RedisModule_ReplyWithLongLong(ctx, 1);
     return REDISMODULE_ERR;
   }
 
   // THE ACTUAL EXPIRATION 
-  if (set_ttl(rtxStore, element_key, element_key_len, ttl_ms) == REDISMODULE_OK) {
+  if (set_ttl(ctx, element_key, element_key_len, ttl_ms, precision_ms) == REDISMODULE_OK) {
     RedisModule_ReplyWithCallReply(ctx, call_reply);
     return REDISMODULE_OK;
   } else {
@@ -330,7 +720,251 @@ int ExecuteAndExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
   }
 }
 
-int CreateRTEXP() {
+// 7. MREXPIRE {key} {ttl_ms} [{key} {ttl_ms} ...]
+int MultiExpireCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3 || argc % 2 == 0) return RedisModule_WrongArity(ctx);
+
+  if (!rtxStore) {
+    RedisModule_ReplyWithError(ctx, "Store was not initialized");
+    return REDISMODULE_ERR;
+  }
+
+  int count = (argc - 1) / 2;
+  mstime_t *ttls = RedisModule_PoolAlloc(ctx, count * sizeof(mstime_t));
+  int i;
+
+  // validate everything before expiring anything
+  for (i = 0; i < count; ++i) {
+    if (RedisModule_StringToLongLong(argv[2 + 2 * i], &ttls[i]) == REDISMODULE_ERR) {
+      RedisModule_ReplyWithError(ctx, "Timestamp must be parsable to type Long Long");
+      return REDISMODULE_ERR;
+    }
+    if (ttls[i] <= 0) {
+      RedisModule_ReplyWithError(ctx, "Expiration time must be in the future");
+      return REDISMODULE_ERR;
+    }
+  }
+
+  // set redis' own expiration through the key, rather than a PEXPIRE call per key
+  mstime_t now = rm_current_time_ms(), first_at = -1;
+  RedisModule_ReplyWithArray(ctx, count);
+  for (i = 0; i < count; ++i) {
+    RedisModuleString *key_str = argv[1 + 2 * i];
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, key_str, REDISMODULE_READ | REDISMODULE_WRITE);
+    int exists = RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY &&
+                 RedisModule_SetExpire(key, ttls[i] + rtxStore->precision_ms - 1 +
+                                       RTEXP_BUFFER_MS) == REDISMODULE_OK;
+    RedisModule_CloseKey(key);
+    RedisModule_ReplyWithLongLong(ctx, exists ? 0 : 1);
+    if (!exists) continue;
+
+    size_t len;
+    const char *element_key = RedisModule_StringPtrLen(key_str, &len);
+    mstime_t at_ms = expiration_deadline(now, ttls[i], rtxStore->precision_ms);
+    enqueueOp(ctx, RTEXP_OP_SCHEDULE, element_key, len, at_ms);
+    if (first_at < 0 || at_ms < first_at) first_at = at_ms;
+  }
+
+  // the queue is applied a batch at a time, so the timer thread still stores the keys together
+  scheduleWakeup(ctx, first_at);
+  return REDISMODULE_OK;
+}
+
+// 8. MRTTL {key} [{key} ...]
+int MultiTTLCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 2) return RedisModule_WrongArity(ctx);
+
+  if (!rtxStore) {
+    RedisModule_ReplyWithError(ctx, "Store was not initialized");
+    return REDISMODULE_ERR;
+  }
+
+  int i;
+  RedisModule_ReplyWithArray(ctx, argc - 1);
+  for (i = 1; i < argc; ++i) {
+    const char *element_key = RedisModule_StringPtrLen(argv[i], NULL);
+    RedisModule_ReplyWithLongLong(ctx, get_ttl(ctx, rtxStore, (char *)element_key));
+  }
+  return REDISMODULE_OK;
+}
+
+/*
+ * Pick the store's indexes and default precision from the module's load arguments:
+ * [BACKEND heap|wheel|radix|bucket] [KEYINDEX trie|hash] [PRECISION {ms}]
+ */
+int parseStoreArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
+                   RTXBackend *backend, RTXKeyBackend *keys, mstime_t *precision_ms) {
+  const char *name;
+  if (RMUtil_ArgIndex("BACKEND", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("BACKEND", argv, argc, "c", &name) == REDISMODULE_ERR ||
+        RTXBackend_FromName(name, backend) != RTXS_OK) {
+      RedisModule_Log(ctx, "warning", "BACKEND must be one of heap, wheel, radix or bucket");
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("KEYINDEX", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("KEYINDEX", argv, argc, "c", &name) == REDISMODULE_ERR ||
+        RTXKeyBackend_FromName(name, keys) != RTXS_OK) {
+      RedisModule_Log(ctx, "warning", "KEYINDEX must be one of trie or hash");
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("PRECISION", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("PRECISION", argv, argc, "l", precision_ms) == REDISMODULE_ERR ||
+        *precision_ms <= 0) {
+      RedisModule_Log(ctx, "warning", "PRECISION must be a positive number of milliseconds");
+      return REDISMODULE_ERR;
+    }
+  }
+  return REDISMODULE_OK;
+}
+
+/*
+ * Parse a list of CPUs and CPU ranges, such as "2,3" or "0-3,8"
+ * @return the number of CPUs, -1 if the list is malformed
+ */
+int parseCPUList(const char *list, int *cpus, int max) {
+  int n = 0;
+  char *end;
+  while (*list) {
+    long first = strtol(list, &end, 10), last = first;
+    if (end == list || first < 0) return -1;
+    if (*end == '-') {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+      if (end == list || last < first) return -1;
+    }
+    for (; first <= last; ++first) {
+      if (n == max) return -1;
+      cpus[n++] = first;
+    }
+    if (*end == ',') ++end;
+    else if (*end) return -1;
+    list = end;
+  }
+  return n;
+}
+
+/*
+ * Read the timer's load arguments:
+ * [TIMER thread|eventloop] [SPIN {max_us}] [SCHED fifo|rr|other] [SCHED_PRIORITY {priority}] [CPUS {list}] [MLOCK]
+ * [TICK_KEYS {keys}] [TICK_US {us}]
+ */
+int parseTimerArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, RTEXPTimerArgs *args) {
+  const char *name;
+  if (RMUtil_ArgIndex("TIMER", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("TIMER", argv, argc, "c", &name) == REDISMODULE_ERR) name = "";
+    if (!strcasecmp(name, "thread")) args->event_loop = 0;
+    else if (!strcasecmp(name, "eventloop")) args->event_loop = 1;
+    else {
+      RedisModule_Log(ctx, "warning", "TIMER must be one of thread or eventloop");
+      return REDISMODULE_ERR;
+    }
+    if (args->event_loop && !RedisModule_CreateTimer) {
+      RedisModule_Log(ctx, "warning", "TIMER eventloop needs module timers (redis 5 or later)");
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("SPIN", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("SPIN", argv, argc, "l", &args->spin_us) == REDISMODULE_ERR ||
+        args->spin_us < 0 || args->spin_us > RTEXP_MAX_SPIN_US) {
+      RedisModule_Log(ctx, "warning", "SPIN must be between 0 and %d microseconds",
+                      RTEXP_MAX_SPIN_US);
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("SCHED", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("SCHED", argv, argc, "c", &name) == REDISMODULE_ERR) name = "";
+    if (!strcasecmp(name, "fifo")) args->policy = SCHED_FIFO;
+    else if (!strcasecmp(name, "rr")) args->policy = SCHED_RR;
+    else if (!strcasecmp(name, "other")) args->policy = SCHED_OTHER;
+    else {
+      RedisModule_Log(ctx, "warning", "SCHED must be one of fifo, rr or other");
+      return REDISMODULE_ERR;
+    }
+    args->priority = sched_get_priority_min(args->policy);
+  }
+  if (RMUtil_ArgIndex("SCHED_PRIORITY", argv, argc) >= 0) {
+    int policy = args->policy < 0 ? SCHED_OTHER : args->policy;
+    if (RMUtil_ParseArgsAfter("SCHED_PRIORITY", argv, argc, "l", &args->priority) ==
+            REDISMODULE_ERR ||
+        args->priority < sched_get_priority_min(policy) ||
+        args->priority > sched_get_priority_max(policy)) {
+      RedisModule_Log(ctx, "warning", "SCHED_PRIORITY must be between %d and %d",
+                      sched_get_priority_min(policy), sched_get_priority_max(policy));
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("CPUS", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("CPUS", argv, argc, "c", &name) == REDISMODULE_ERR ||
+        (args->ncpus = parseCPUList(name, args->cpus, RTEXP_MAX_CPUS)) <= 0) {
+      RedisModule_Log(ctx, "warning", "CPUS must be a list of CPUs, such as 2,3 or 0-3");
+      return REDISMODULE_ERR;
+    }
+  }
+  args->mlock = RMUtil_ArgIndex("MLOCK", argv, argc) >= 0;
+  if (RMUtil_ArgIndex("TICK_KEYS", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("TICK_KEYS", argv, argc, "l", &args->tick_keys) == REDISMODULE_ERR ||
+        args->tick_keys < 0) {
+      RedisModule_Log(ctx, "warning", "TICK_KEYS must be a number of keys, 0 for no limit");
+      return REDISMODULE_ERR;
+    }
+  }
+  if (RMUtil_ArgIndex("TICK_US", argv, argc) >= 0) {
+    if (RMUtil_ParseArgsAfter("TICK_US", argv, argc, "l", &args->tick_us) == REDISMODULE_ERR ||
+        args->tick_us < 0) {
+      RedisModule_Log(ctx, "warning", "TICK_US must be a number of microseconds, 0 for no limit");
+      return REDISMODULE_ERR;
+    }
+  }
+  return REDISMODULE_OK;
+}
+
+/*
+ * Set up the timer thread as asked for. Missing privileges are not fatal: the thread keeps
+ * running as it is, with a warning.
+ */
+void setupTimerThread(RedisModuleCtx *ctx, RTEXPTimerArgs *args) {
+  int rc;
+  RMUtilTimer_SetSpin(expiration_timer, args->spin_us * 1000);
+
+  if (args->policy >= 0 &&
+      (rc = RMUtilTimer_SetScheduling(expiration_timer, args->policy, args->priority)) != 0) {
+    RedisModule_Log(ctx, "warning",
+                    "could not set the expiration thread's scheduling policy: %s%s. "
+                    "Running under the default policy",
+                    strerror(rc), rc == EPERM ? " (needs CAP_SYS_NICE or an RLIMIT_RTPRIO)" : "");
+  }
+  if (args->ncpus > 0 &&
+      (rc = RMUtilTimer_SetAffinity(expiration_timer, args->cpus, args->ncpus)) != 0) {
+    RedisModule_Log(ctx, "warning",
+                    "could not pin the expiration thread to its CPUS: %s. Running on any CPU",
+                    strerror(rc));
+  }
+}
+
+/*
+ * Set up the expiration timer, and the memory locking, as asked for
+ */
+void setupTimer(RedisModuleCtx *ctx, RTEXPTimerArgs *args) {
+  int rc;
+  if (args->event_loop) {
+    if (args->spin_us || args->policy >= 0 || args->ncpus > 0) {
+      RedisModule_Log(ctx, "warning", "SPIN, SCHED and CPUS are ignored with TIMER eventloop");
+    }
+  } else {
+    setupTimerThread(ctx, args);
+  }
+  // locks all of redis' memory, the store's included, as it can not be told apart
+  if (args->mlock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    rc = errno;
+    RedisModule_Log(ctx, "warning", "could not lock memory: %s%s. Memory may be swapped out",
+                    strerror(rc),
+                    (rc == EPERM || rc == ENOMEM) ? " (needs CAP_IPC_LOCK or an RLIMIT_MEMLOCK)" : "");
+  }
+}
+
+int CreateRTEXP(RTXBackend backend, RTXKeyBackend keys, mstime_t precision_ms) {
   RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
   #ifdef PROFILE_GRANULARITY
   profile_timer_count = 0;
@@ -338,18 +972,49 @@ int CreateRTEXP() {
   for (i=0; i< PROFILE_STORE_SIZE; ++i)
     profiling_array[i] = 0;
   #endif
-  rtxStore = newRTXStore();
-  interval_timer = RMUtil_NewPeriodicTimer( 
-      timerCb, NULL, &rtxStore,
-      (struct timespec){
-          .tv_sec = 0,
-          .tv_nsec = RTEXP_MIN_INTERVAL_NS});  
+  // account for the store's node pools in redis' used memory
+  RTXStore_SetAllocator(RedisModule_Alloc, RedisModule_Free);
+  rtxStore = newRTXStoreWithBackends(backend, keys);
+  commands = mpsc_new(RTEXP_QUEUE_SIZE, sizeof(RTEXPOp));
+  RTXStore_SetPrecision(rtxStore, precision_ms);
+  if (!timer_args.event_loop) expiration_timer = RMUtil_NewDeadlineTimer(timerCb, NULL, &rtxStore);
 
   return REDISMODULE_OK;
 }
 
+// RCOUNT - the expirations in the store as of the timer thread's last change to it, without
+// taking the store's lock. Commands still queued are counted once the timer thread applies them.
 int OutstandingTimerCountCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  RedisModule_ReplyWithLongLong(ctx, expiration_count(rtxStore));
+  if (mpsc_count(commands) > 0) scheduleWakeup(ctx, rm_current_time_ms());
+  RedisModule_ReplyWithLongLong(ctx, __atomic_load_n(&published_count, __ATOMIC_RELAXED));
+  return REDISMODULE_OK;
+}
+
+// RTIMERSTATS - how late the timer thread woke up for the expirations, in nanoseconds, and how
+// far behind it is
+int TimerStatsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  RMUtilTimerStats stats = loop_stats;
+  if (!timer_args.event_loop) RMUtilTimer_GetStats(expiration_timer, &stats);
+
+  RedisModule_ReplyWithArray(ctx, 18);
+  RedisModule_ReplyWithSimpleString(ctx, "wakeups");
+  RedisModule_ReplyWithLongLong(ctx, stats.runs);
+  RedisModule_ReplyWithSimpleString(ctx, "last_latency_ns");
+  RedisModule_ReplyWithLongLong(ctx, stats.lastLatencyNs);
+  RedisModule_ReplyWithSimpleString(ctx, "max_latency_ns");
+  RedisModule_ReplyWithLongLong(ctx, stats.maxLatencyNs);
+  RedisModule_ReplyWithSimpleString(ctx, "avg_latency_ns");
+  RedisModule_ReplyWithLongLong(ctx, stats.runs ? stats.totalLatencyNs / (long long)stats.runs : 0);
+  RedisModule_ReplyWithSimpleString(ctx, "early_wake_ns");
+  RedisModule_ReplyWithLongLong(ctx, stats.earlyWakeNs);
+  RedisModule_ReplyWithSimpleString(ctx, "expired");
+  RedisModule_ReplyWithLongLong(ctx, tick_stats.expired);
+  RedisModule_ReplyWithSimpleString(ctx, "overruns");
+  RedisModule_ReplyWithLongLong(ctx, tick_stats.overruns);
+  RedisModule_ReplyWithSimpleString(ctx, "backlog_ms");
+  RedisModule_ReplyWithLongLong(ctx, tick_stats.backlog_ms);
+  RedisModule_ReplyWithSimpleString(ctx, "timer");
+  RedisModule_ReplyWithSimpleString(ctx, timer_args.event_loop ? "eventloop" : "thread");
   return REDISMODULE_OK;
 }
 
@@ -367,7 +1032,7 @@ int PrintProfileCommand (RedisModuleCtx *ctx, RedisModuleString **argv, int argc
 
 
 // Init Module
-int RedisModule_OnLoad(RedisModuleCtx *ctx) {
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   // Register the module itself
   if (RedisModule_Init(ctx, "RTEXP", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR) {
     return REDISMODULE_ERR;
@@ -376,7 +1041,25 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx) {
   RedisModule_AutoMemory(ctx);
 
   // Init internals
-  CreateRTEXP();
+  RTXBackend backend = RTXS_BACKEND_HEAP;
+  RTXKeyBackend keys = RTXS_KEYS_TRIE;
+  mstime_t precision_ms = 1;
+  if (parseStoreArgs(ctx, argv, argc, &backend, &keys, &precision_ms) == REDISMODULE_ERR ||
+      parseTimerArgs(ctx, argv, argc, &timer_args) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+  RedisModule_Log(ctx, "notice", "expiration store: %s deadline index, %s key index, %lldms precision",
+                  RTXDeadlineIndex_Type(backend)->name, RTXKeyIndex_Type(keys)->name, precision_ms);
+  CreateRTEXP(backend, keys, precision_ms);
+  setupTimer(ctx, &timer_args);
+  if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC |
+                                                 REDISMODULE_NOTIFY_STRING |
+                                                 REDISMODULE_NOTIFY_EXPIRED |
+                                                 REDISMODULE_NOTIFY_EVICTED,
+                                            keyspaceEventCb) == REDISMODULE_ERR) {
+    RedisModule_Log(ctx, "warning", "could not subscribe to keyspace events");
+    return REDISMODULE_ERR;
+  }
 
   // register commands - using the shortened utility registration macro
   RMUtil_RegisterWriteCmd(ctx, "REXPIRE", ExpireCommand);
@@ -385,7 +1068,16 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx) {
   RMUtil_RegisterWriteCmd(ctx, "RUNEXPIRE", UnexpireCommand);
   RMUtil_RegisterWriteCmd(ctx, "RSETEX", SetexCommand);
   RMUtil_RegisterWriteCmd(ctx, "REXECEX", ExecuteAndExpireCommand);
+  // every key of the multi-key commands must be known to redis, for cluster slots and ACLs:
+  // MREXPIRE takes {key} {ttl_ms} pairs, MRTTL keys only
+  if (RedisModule_CreateCommand(ctx, "MREXPIRE", MultiExpireCommand, "write", 1, -1, 2) ==
+          REDISMODULE_ERR ||
+      RedisModule_CreateCommand(ctx, "MRTTL", MultiTTLCommand, "readonly", 1, -1, 1) ==
+          REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
   RMUtil_RegisterWriteCmd(ctx, "RCOUNT", OutstandingTimerCountCommand);
+  RMUtil_RegisterWriteCmd(ctx, "RTIMERSTATS", TimerStatsCommand);
 
   RMUtil_RegisterWriteCmd(ctx, "RPROFILE", PrintProfileCommand);
   return REDISMODULE_OK;
@@ -0,0 +1,441 @@
+/* The deadline and key index types available to the real-time expiration data store.
+ */
+#include "rtx_backend.h"
+#include "librtexp.h"
+
+#include "trie/triemap.h"
+#include "util/bucket_heap.h"
+#include "util/deadline_heap.h"
+#include "util/radix_heap.h"
+#include "util/swiss_table.h"
+#include "util/timing_wheel.h"
+
+#include <stddef.h>
+#include <strings.h>
+
+// adapts an index's own iteration callback to an RTXIterateCB
+typedef struct {
+  RTXIterateCB cb;
+  void* udata;
+} _iterate_ctx;
+
+/***************************
+ *   4-ary heap
+ ***************************/
+void* _heap_create(void) {
+  // the heap keeps the node's index up to date by itself
+  return dheap_new(offsetof(RTXElementNode, heap_idx));
+}
+
+void _heap_free(void* index) {
+  dheap_free(index);
+}
+
+int _heap_offer(void* index, RTXElementNode* node) {
+  return dheap_offer(index, node->exp.time, node);
+}
+
+size_t _heap_offer_batch(void* index, RTXElementNode** nodes, size_t n) {
+  dheap_entry_t* entries = malloc(n * sizeof(dheap_entry_t));
+  size_t i;
+  if (entries == NULL) {
+    // no room to batch them, offer one by one
+    for (i = 0; i < n && dheap_offer(index, nodes[i]->exp.time, nodes[i]) == 0; ++i)
+      ;
+    return i;
+  }
+  for (i = 0; i < n; ++i) {
+    entries[i].deadline = nodes[i]->exp.time;
+    entries[i].item = nodes[i];
+  }
+  i = dheap_offer_batch(index, entries, n);
+  free(entries);
+  return i;
+}
+
+RTXElementNode* _heap_peek(void* index) {
+  return dheap_peek(index);
+}
+
+RTXElementNode* _heap_poll(void* index) {
+  return dheap_poll(index);
+}
+
+size_t _heap_poll_due(void* index, long long deadline, RTXElementNode** out, size_t max) {
+  size_t n = 0;
+  while (n < max && dheap_count(index) > 0 && dheap_peek_deadline(index) <= deadline)
+    out[n++] = dheap_poll(index);
+  return n;
+}
+
+void _heap_remove(void* index, RTXElementNode* node) {
+  dheap_remove_idx(index, node->heap_idx);
+}
+
+int _heap_update(void* index, RTXElementNode* node) {
+  dheap_update_idx(index, node->heap_idx, node->exp.time);
+  return 0;
+}
+
+size_t _heap_count(void* index) {
+  return dheap_count(index);
+}
+
+size_t _heap_memusage(void* index) {
+  return dheap_memusage(index);
+}
+
+void _heap_iterate_item(void* item, void* udata) {
+  _iterate_ctx* ctx = udata;
+  ctx->cb(item, ctx->udata);
+}
+
+void _heap_iterate(void* index, RTXIterateCB cb, void* udata) {
+  _iterate_ctx ctx = {cb, udata};
+  dheap_iterate(index, _heap_iterate_item, &ctx);
+}
+
+/***************************
+ *   Timing wheel
+ ***************************/
+void* _wheel_create(void) {
+  return wheel_new();
+}
+
+void _wheel_free(void* index) {
+  wheel_free(index);
+}
+
+int _wheel_offer(void* index, RTXElementNode* node) {
+  wheel_offer(index, &node->wheel_link, node->exp.time);
+  return 0;
+}
+
+size_t _wheel_offer_batch(void* index, RTXElementNode** nodes, size_t n) {
+  size_t i;
+  for (i = 0; i < n; ++i) wheel_offer(index, &nodes[i]->wheel_link, nodes[i]->exp.time);
+  return n;
+}
+
+RTXElementNode* _wheel_peek(void* index) {
+  wheel_node_t* link = wheel_peek(index);
+  return link ? wheel_entry(link, RTXElementNode, wheel_link) : NULL;
+}
+
+RTXElementNode* _wheel_poll(void* index) {
+  wheel_node_t* link = wheel_poll(index);
+  return link ? wheel_entry(link, RTXElementNode, wheel_link) : NULL;
+}
+
+size_t _wheel_poll_due(void* index, long long deadline, RTXElementNode** out, size_t max) {
+  size_t n = 0;
+  wheel_node_t* link;
+  while (n < max && (link = wheel_peek(index)) != NULL && link->deadline <= deadline)
+    out[n++] = wheel_entry(wheel_poll(index), RTXElementNode, wheel_link);
+  return n;
+}
+
+void _wheel_remove(void* index, RTXElementNode* node) {
+  wheel_remove(index, &node->wheel_link);
+}
+
+int _wheel_update(void* index, RTXElementNode* node) {
+  wheel_remove(index, &node->wheel_link);
+  wheel_offer(index, &node->wheel_link, node->exp.time);
+  return 0;
+}
+
+size_t _wheel_count(void* index) {
+  return wheel_count(index);
+}
+
+size_t _wheel_memusage(void* index) {
+  return sizeof(timing_wheel_t);
+}
+
+void _wheel_iterate_link(wheel_node_t* link, void* udata) {
+  _iterate_ctx* ctx = udata;
+  ctx->cb(wheel_entry(link, RTXElementNode, wheel_link), ctx->udata);
+}
+
+void _wheel_iterate(void* index, RTXIterateCB cb, void* udata) {
+  _iterate_ctx ctx = {cb, udata};
+  wheel_iterate(index, _wheel_iterate_link, &ctx);
+}
+
+/***************************
+ *   Radix heap
+ ***************************/
+void* _radix_create(void) {
+  return radix_new();
+}
+
+void _radix_free(void* index) {
+  radix_free(index);
+}
+
+int _radix_offer(void* index, RTXElementNode* node) {
+  radix_offer(index, &node->radix_link, node->exp.time);
+  return 0;
+}
+
+size_t _radix_offer_batch(void* index, RTXElementNode** nodes, size_t n) {
+  size_t i;
+  for (i = 0; i < n; ++i) radix_offer(index, &nodes[i]->radix_link, nodes[i]->exp.time);
+  return n;
+}
+
+RTXElementNode* _radix_peek(void* index) {
+  radix_node_t* link = radix_peek(index);
+  return link ? radix_entry(link, RTXElementNode, radix_link) : NULL;
+}
+
+RTXElementNode* _radix_poll(void* index) {
+  radix_node_t* link = radix_poll(index);
+  return link ? radix_entry(link, RTXElementNode, radix_link) : NULL;
+}
+
+size_t _radix_poll_due(void* index, long long deadline, RTXElementNode** out, size_t max) {
+  size_t n = 0;
+  radix_node_t* link;
+  while (n < max && (link = radix_peek(index)) != NULL && link->deadline <= deadline)
+    out[n++] = radix_entry(radix_poll(index), RTXElementNode, radix_link);
+  return n;
+}
+
+void _radix_remove(void* index, RTXElementNode* node) {
+  radix_remove(index, &node->radix_link);
+}
+
+int _radix_update(void* index, RTXElementNode* node) {
+  radix_remove(index, &node->radix_link);
+  radix_offer(index, &node->radix_link, node->exp.time);
+  return 0;
+}
+
+size_t _radix_count(void* index) {
+  return radix_count(index);
+}
+
+size_t _radix_memusage(void* index) {
+  return sizeof(radix_heap_t);
+}
+
+void _radix_iterate_link(radix_node_t* link, void* udata) {
+  _iterate_ctx* ctx = udata;
+  ctx->cb(radix_entry(link, RTXElementNode, radix_link), ctx->udata);
+}
+
+void _radix_iterate(void* index, RTXIterateCB cb, void* udata) {
+  _iterate_ctx ctx = {cb, udata};
+  radix_iterate(index, _radix_iterate_link, &ctx);
+}
+
+/***************************
+ *   Deadline buckets
+ ***************************/
+void* _bucket_create(void) {
+  return bheap_new(offsetof(RTXElementNode, bucket_link));
+}
+
+void _bucket_free(void* index) {
+  bheap_free(index);
+}
+
+int _bucket_offer(void* index, RTXElementNode* node) {
+  return bheap_offer(index, node->exp.time, node);
+}
+
+size_t _bucket_offer_batch(void* index, RTXElementNode** nodes, size_t n) {
+  size_t i;
+  for (i = 0; i < n && bheap_offer(index, nodes[i]->exp.time, nodes[i]) == 0; ++i)
+    ;
+  return i;
+}
+
+RTXElementNode* _bucket_peek(void* index) {
+  return bheap_peek(index);
+}
+
+RTXElementNode* _bucket_poll(void* index) {
+  return bheap_poll(index);
+}
+
+size_t _bucket_poll_due(void* index, long long deadline, RTXElementNode** out, size_t max) {
+  return bheap_poll_due(index, deadline, (void**)out, max);
+}
+
+void _bucket_remove(void* index, RTXElementNode* node) {
+  bheap_remove(index, node);
+}
+
+int _bucket_update(void* index, RTXElementNode* node) {
+  // refreshed within the same millisecond, e.g. by a burst
+  if (node->bucket_link.bucket->deadline == node->exp.time) return 0;
+  bheap_remove(index, node);
+  // the new deadline may need a bucket of its own, which can fail to allocate
+  return bheap_offer(index, node->exp.time, node);
+}
+
+size_t _bucket_count(void* index) {
+  return bheap_count(index);
+}
+
+size_t _bucket_memusage(void* index) {
+  return bheap_memusage(index);
+}
+
+void _bucket_iterate(void* index, RTXIterateCB cb, void* udata) {
+  // the callbacks only differ in their item's pointer type
+  _iterate_ctx ctx = {cb, udata};
+  bheap_iterate(index, _heap_iterate_item, &ctx);
+}
+
+/***************************
+ *   Trie
+ ***************************/
+void* _trie_create(void) {
+  return NewTrieMap();
+}
+
+void _trie_free(void* index, void (*freeCB)(void*)) {
+  TrieMap_Free(index, freeCB);
+}
+
+int _trie_add(void* index, RTXElementNode* node) {
+  TrieMap_Add(index, node->key, node->len, node, NULL);
+  return 0;
+}
+
+RTXElementNode* _trie_find(void* index, char* key, size_t len) {
+  RTXElementNode* node = TrieMap_Find(index, key, len);
+  if (node == TRIEMAP_NOTFOUND)
+    return NULL;
+  return node;
+}
+
+void _trie_keep_node(void* node) { return; }
+
+void _trie_del(void* index, char* key, size_t len) {
+  TrieMap_Delete(index, key, len, _trie_keep_node);
+}
+
+size_t _trie_count(void* index) {
+  return ((TrieMap*)index)->cardinality;
+}
+
+size_t _trie_memusage(void* index) {
+  return sizeof(TrieMap) + TrieMap_MemUsage(index);
+}
+
+void _trie_iterate(void* index, RTXIterateCB cb, void* udata) {
+  TrieMapIterator* it = TrieMap_Iterate(index, "", 0);
+  char* key;
+  tm_len_t len;
+  void* node;
+  while (TrieMapIterator_Next(it, &key, &len, &node)) cb(node, udata);
+  TrieMapIterator_Free(it);
+}
+
+/***************************
+ *   Hash table
+ ***************************/
+void* _hash_create(void) {
+  return swiss_new();
+}
+
+void _hash_free_node(void* node, void* freeCB) {
+  ((void (*)(void*))freeCB)(node);
+}
+
+void _hash_free(void* index, void (*freeCB)(void*)) {
+  swiss_iterate(index, _hash_free_node, freeCB);
+  swiss_free(index);
+}
+
+int _hash_add(void* index, RTXElementNode* node) {
+  // the table points to the node's own key, which lives exactly as long as the node
+  return swiss_insert(index, node->key, node->len, node) < 0 ? -1 : 0;
+}
+
+RTXElementNode* _hash_find(void* index, char* key, size_t len) {
+  return swiss_find(index, key, len);
+}
+
+void _hash_del(void* index, char* key, size_t len) {
+  swiss_delete(index, key, len);
+}
+
+size_t _hash_count(void* index) {
+  return swiss_count(index);
+}
+
+size_t _hash_memusage(void* index) {
+  return swiss_memusage(index);
+}
+
+void _hash_iterate_node(void* node, void* udata) {
+  _iterate_ctx* ctx = udata;
+  ctx->cb(node, ctx->udata);
+}
+
+void _hash_iterate(void* index, RTXIterateCB cb, void* udata) {
+  _iterate_ctx ctx = {cb, udata};
+  swiss_iterate(index, _hash_iterate_node, &ctx);
+}
+
+/***************************
+ *   Type tables
+ ***************************/
+static const RTXDeadlineIndexType deadline_index_types[RTXS_BACKEND_COUNT] = {
+    [RTXS_BACKEND_HEAP] = {"heap", _heap_create, _heap_free, _heap_offer, _heap_offer_batch,
+                           _heap_peek, _heap_poll, _heap_poll_due, _heap_remove, _heap_update,
+                           _heap_count, _heap_memusage, _heap_iterate},
+    [RTXS_BACKEND_WHEEL] = {"wheel", _wheel_create, _wheel_free, _wheel_offer, _wheel_offer_batch,
+                            _wheel_peek, _wheel_poll, _wheel_poll_due, _wheel_remove,
+                            _wheel_update, _wheel_count, _wheel_memusage, _wheel_iterate},
+    [RTXS_BACKEND_RADIX] = {"radix", _radix_create, _radix_free, _radix_offer, _radix_offer_batch,
+                            _radix_peek, _radix_poll, _radix_poll_due, _radix_remove,
+                            _radix_update, _radix_count, _radix_memusage, _radix_iterate},
+    [RTXS_BACKEND_BUCKET] = {"bucket", _bucket_create, _bucket_free, _bucket_offer,
+                             _bucket_offer_batch, _bucket_peek, _bucket_poll, _bucket_poll_due,
+                             _bucket_remove, _bucket_update, _bucket_count, _bucket_memusage,
+                             _bucket_iterate},
+};
+
+static const RTXKeyIndexType key_index_types[RTXS_KEYS_COUNT] = {
+    [RTXS_KEYS_TRIE] = {"trie", _trie_create, _trie_free, _trie_add, _trie_find, _trie_del,
+                        _trie_count, _trie_memusage, _trie_iterate},
+    [RTXS_KEYS_HASH] = {"hash", _hash_create, _hash_free, _hash_add, _hash_find, _hash_del,
+                        _hash_count, _hash_memusage, _hash_iterate},
+};
+
+const RTXDeadlineIndexType* RTXDeadlineIndex_Type(RTXBackend backend) {
+  return &deadline_index_types[backend];
+}
+
+const RTXKeyIndexType* RTXKeyIndex_Type(RTXKeyBackend backend) {
+  return &key_index_types[backend];
+}
+
+int RTXBackend_FromName(const char* name, RTXBackend* backend) {
+  int i;
+  for (i = 0; i < RTXS_BACKEND_COUNT; ++i) {
+    if (strcasecmp(name, deadline_index_types[i].name) == 0) {
+      *backend = i;
+      return RTXS_OK;
+    }
+  }
+  return RTXS_ERR;
+}
+
+int RTXKeyBackend_FromName(const char* name, RTXKeyBackend* backend) {
+  int i;
+  for (i = 0; i < RTXS_KEYS_COUNT; ++i) {
+    if (strcasecmp(name, key_index_types[i].name) == 0) {
+      *backend = i;
+      return RTXS_OK;
+    }
+  }
+  return RTXS_ERR;
+}
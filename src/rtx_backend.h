@@ -0,0 +1,95 @@
+/* Pluggable indexes of the real-time expiration data store.
+ * A store keeps its element nodes in two indexes: a deadline index, sorting the nodes by
+ * expiration, and a key index, mapping keys to nodes. Each one is used only through the
+ * function table of its type, so both can be picked when the store is created.
+ */
+#ifndef RTX_BACKEND_H
+#define RTX_BACKEND_H
+
+#include <stddef.h>
+
+struct rtxs_node;
+
+/* The structure keeping the expirations sorted by datetime */
+typedef enum {
+  RTXS_BACKEND_HEAP = 0,   // 4-ary heap of inline deadlines, O(log n) insert and pop
+  RTXS_BACKEND_WHEEL = 1,  // hierarchical timing wheel, O(1) insert and amortized O(1) pop
+  RTXS_BACKEND_RADIX = 2,  // radix heap, O(1) insert and amortized O(log C) pop
+  RTXS_BACKEND_BUCKET = 3, // heap of per deadline buckets, O(1) insert at a known deadline
+  RTXS_BACKEND_COUNT
+} RTXBackend;
+
+/* The structure mapping keys to their element nodes */
+typedef enum {
+  RTXS_KEYS_TRIE = 0,  // adaptive radix tree, O(key length) lookup
+  RTXS_KEYS_HASH = 1,  // open addressing hash table, O(1) lookup
+  RTXS_KEYS_COUNT
+} RTXKeyBackend;
+
+typedef void (*RTXIterateCB)(struct rtxs_node* node, void* udata);
+
+typedef struct {
+  const char* name;
+  void* (*create)(void);
+  void (*free)(void* index);
+  // schedule a node by its exp.time, @return 0 on success, -1 on failure
+  int (*offer)(void* index, struct rtxs_node* node);
+  // schedule n nodes at once, @return the number of nodes scheduled, the first ones of nodes
+  size_t (*offer_batch)(void* index, struct rtxs_node** nodes, size_t n);
+  // @return the node expiring first, NULL if the index is empty
+  struct rtxs_node* (*peek)(void* index);
+  struct rtxs_node* (*poll)(void* index);
+  // remove the nodes expiring at or before deadline, in order, up to max of them into out
+  // @return the number of nodes removed
+  size_t (*poll_due)(void* index, long long deadline, struct rtxs_node** out, size_t max);
+  void (*remove)(void* index, struct rtxs_node* node);
+  // re-sort a scheduled node after its exp.time was changed
+  // @return 0 on success, -1 on failure, leaving the node out of the index
+  int (*update)(void* index, struct rtxs_node* node);
+  size_t (*count)(void* index);
+  size_t (*memusage)(void* index);
+  // call cb for every node, in no particular order
+  void (*iterate)(void* index, RTXIterateCB cb, void* udata);
+} RTXDeadlineIndexType;
+
+typedef struct {
+  const char* name;
+  void* (*create)(void);
+  // free the index, calling freeCB for every node still in it
+  void (*free)(void* index, void (*freeCB)(void*));
+  // add a node under its own key, which an index may point to rather than copy
+  // @return 0 on success, -1 on failure
+  int (*add)(void* index, struct rtxs_node* node);
+  // @return the key's node, NULL if there is none
+  struct rtxs_node* (*find)(void* index, char* key, size_t len);
+  // remove the key, without freeing its node
+  void (*del)(void* index, char* key, size_t len);
+  size_t (*count)(void* index);
+  size_t (*memusage)(void* index);
+  // call cb for every node, in no particular order
+  void (*iterate)(void* index, RTXIterateCB cb, void* udata);
+} RTXKeyIndexType;
+
+/*
+ * @return the function table of a deadline index type
+ */
+const RTXDeadlineIndexType* RTXDeadlineIndex_Type(RTXBackend backend);
+
+/*
+ * @return the function table of a key index type
+ */
+const RTXKeyIndexType* RTXKeyIndex_Type(RTXKeyBackend backend);
+
+/*
+ * Look up a deadline index type by name ("heap", "wheel", "radix" or "bucket")
+ * @return RTXS_OK if found, RTXS_ERR otherwise
+ */
+int RTXBackend_FromName(const char* name, RTXBackend* backend);
+
+/*
+ * Look up a key index type by name ("trie" or "hash")
+ * @return RTXS_OK if found, RTXS_ERR otherwise
+ */
+int RTXKeyBackend_FromName(const char* name, RTXKeyBackend* backend);
+
+#endif
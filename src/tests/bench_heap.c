@@ -0,0 +1,99 @@
+/* Micro benchmark for the heap backends alone: ns/op of offering items with random deadlines
+ * and polling everything out again, with the generic binary heap (comparator callback, deadline
+ * behind the item pointer) against the 4-ary deadline heap, as well as the single slowest offer,
+ * which is where growing the heap's storage shows up, and of rescheduling items in place with the
+ * 4-ary heap, which the binary heap cannot do.
+ *
+ * usage: bench_heap.run [number of items]
+ */
+#include "../util/deadline_heap.h"
+#include "../util/heap.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_ITEM_COUNT 10000000
+#define MAX_TTL_MS 86400000
+
+typedef struct {
+  long long deadline;
+  unsigned int idx;
+} bench_item_t;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_item(const void* a, const void* b, const void* udata) {
+  long long da = ((const bench_item_t*)a)->deadline, db = ((const bench_item_t*)b)->deadline;
+  return (db < da) ? -1 : (db > da);
+}
+
+static void bench_binary(bench_item_t* items, int count) {
+  heap_t* h = heap_new(cmp_item, NULL);
+  double start, worst = 0;
+  int i;
+
+  srand(42);
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    double op_start = now_ns();
+    items[i].deadline = rand() % MAX_TTL_MS;
+    heap_offer(&h, &items[i]);
+    if (now_ns() - op_start > worst) worst = now_ns() - op_start;
+  }
+  printf("  binary offer:      %8.1f ns/op, worst %.0f us\n", (now_ns() - start) / count,
+         worst / 1000);
+
+  start = now_ns();
+  while (heap_poll(h) != NULL)
+    ;
+  printf("  binary poll:       %8.1f ns/op\n", (now_ns() - start) / count);
+  heap_free(h);
+}
+
+static void bench_dary(bench_item_t* items, int count) {
+  dheap_t* h = dheap_new(offsetof(bench_item_t, idx));
+  double start, worst = 0;
+  int i;
+
+  srand(42);
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    double op_start = now_ns();
+    items[i].deadline = rand() % MAX_TTL_MS;
+    dheap_offer(h, items[i].deadline, &items[i]);
+    if (now_ns() - op_start > worst) worst = now_ns() - op_start;
+  }
+  printf("  4-ary  offer:      %8.1f ns/op, worst %.0f us\n", (now_ns() - start) / count,
+         worst / 1000);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    bench_item_t* item = &items[rand() % count];
+    item->deadline = rand() % MAX_TTL_MS;
+    dheap_update_idx(h, item->idx, item->deadline);
+  }
+  printf("  4-ary  reschedule: %8.1f ns/op\n", (now_ns() - start) / count);
+
+  start = now_ns();
+  while (dheap_poll(h) != NULL)
+    ;
+  printf("  4-ary  poll:       %8.1f ns/op\n", (now_ns() - start) / count);
+  dheap_free(h);
+}
+
+int main(int argc, char* argv[]) {
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITEM_COUNT;
+  bench_item_t* items = malloc(count * sizeof(bench_item_t));
+
+  printf("%d items:\n", count);
+  bench_binary(items, count);
+  bench_dary(items, count);
+  free(items);
+  return 0;
+}
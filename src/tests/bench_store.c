@@ -0,0 +1,182 @@
+/* Micro benchmark for the expiration store: ns/op of inserting new keys, refreshing the TTL of
+ * existing keys and popping everything out again one by one, of inserting all keys as a single
+ * batch and draining them in batches of due keys, of inserting and draining bursts of keys with
+ * an identical TTL, of a steady state churn (insert a new key, expire the oldest one) over a
+ * small store, and of a typical mix of 70% refreshes and 30% new keys with TTLs from 10ms to 24h
+ * while due keys are expired, and of inserting keys expiring before the store's first key right
+ * after looking it up, for every deadline and key index.
+ *
+ * usage: bench_store.run [number of keys]
+ */
+#include "../librtexp.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_KEY_COUNT 1000000
+#define MAX_TTL_MS 86400000
+#define CHURN_WINDOW 1024
+// due keys popped at a time
+#define DRAIN_BATCH 256
+#define CHURN_KEYS (4 * CHURN_WINDOW)
+#define MIX_MIN_TTL_MS 10
+// every key of the burst phase gets this TTL
+#define BURST_TTL_MS 10000
+#define MIX_REFRESH_PERCENT 70
+// expire due keys every that many operations
+#define MIX_EXPIRE_EVERY 1024
+// keys inserted ahead of the store's first key, each right after looking it up
+#define AHEAD_KEYS 1000
+#define AHEAD_TTL_MS 3600000
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * @return a TTL between MIX_MIN_TTL_MS and MAX_TTL_MS, spread evenly on a log scale
+ */
+static mstime_t mix_ttl(void) {
+  return MIX_MIN_TTL_MS * exp(log((double)MAX_TTL_MS / MIX_MIN_TTL_MS) * rand() / RAND_MAX);
+}
+
+/*
+ * Build count keys, formatted as either short or long (UUID like) keys
+ */
+static char** make_keys(int count, int long_keys) {
+  char** keys = malloc(count * sizeof(char*));
+  char buf[64];
+  int i;
+  for (i = 0; i < count; ++i) {
+    if (long_keys)
+      sprintf(buf, "session:%08x-%04x-%04x-%012d", rand(), rand() & 0xffff, rand() & 0xffff, i);
+    else
+      sprintf(buf, "key:%d", i);
+    keys[i] = strdup(buf);
+  }
+  return keys;
+}
+
+static void bench_backend(RTXBackend backend, RTXKeyBackend key_index, char** keys, int count) {
+  char name[32];
+  sprintf(name, "%s/%s", RTXDeadlineIndex_Type(backend)->name, RTXKeyIndex_Type(key_index)->name);
+  RTXStore* store = newRTXStoreWithBackends(backend, key_index);
+  double start;
+  int i;
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) set_element_exp(store, keys[i], strlen(keys[i]), rand() % MAX_TTL_MS);
+  printf("  %-10s insert:  %8.1f ns/op\n", name, (now_ns() - start) / count);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) set_element_exp(store, keys[i], strlen(keys[i]), rand() % MAX_TTL_MS);
+  printf("  %-10s refresh: %8.1f ns/op\n", name, (now_ns() - start) / count);
+
+  start = now_ns();
+  RTXElementNode* node;
+  while ((node = pop_next(store)) != NULL) freeRTXElementNode(node);
+  printf("  %-10s pop:     %8.1f ns/op\n", name, (now_ns() - start) / count);
+  RTXStore_Free(store);
+
+  store = newRTXStoreWithBackends(backend, key_index);
+  size_t* lens = malloc(count * sizeof(size_t));
+  mstime_t* ttls = malloc(count * sizeof(mstime_t));
+  for (i = 0; i < count; ++i) {
+    lens[i] = strlen(keys[i]);
+    ttls[i] = rand() % MAX_TTL_MS;
+  }
+  start = now_ns();
+  set_element_exp_batch(store, keys, lens, ttls, count);
+  printf("  %-10s batch:   %8.1f ns/op\n", name, (now_ns() - start) / count);
+
+  RTXElementNode* due[DRAIN_BATCH];
+  size_t drained;
+  start = now_ns();
+  while ((drained = pop_due(store, MAX_TTL_MS + current_time_ms(), due, DRAIN_BATCH)) > 0)
+    while (drained > 0) freeRTXElementNode(due[--drained]);
+  printf("  %-10s drain:   %8.1f ns/op\n", name, (now_ns() - start) / count);
+  RTXStore_Free(store);
+
+  // thousands of keys land on every millisecond
+  store = newRTXStoreWithBackends(backend, key_index);
+  start = now_ns();
+  for (i = 0; i < count; ++i) set_element_exp(store, keys[i], lens[i], BURST_TTL_MS);
+  printf("  %-10s burst:   %8.1f ns/op\n", name, (now_ns() - start) / count);
+  start = now_ns();
+  while ((drained = pop_due(store, MAX_TTL_MS + current_time_ms(), due, DRAIN_BATCH)) > 0)
+    while (drained > 0) freeRTXElementNode(due[--drained]);
+  printf("  %-10s drain:   %8.1f ns/op\n", name, (now_ns() - start) / count);
+  free(lens);
+  free(ttls);
+  RTXStore_Free(store);
+
+  store = newRTXStoreWithBackends(backend, key_index);
+  for (i = 0; i < CHURN_WINDOW; ++i) set_element_exp(store, keys[i], strlen(keys[i]), i);
+  start = now_ns();
+  for (i = CHURN_WINDOW; i < count; ++i) {
+    char* key = keys[i % CHURN_KEYS];
+    set_element_exp(store, key, strlen(key), i);
+    freeRTXElementNode(pop_next(store));
+  }
+  printf("  %-10s churn:   %8.1f ns/op\n", name, (now_ns() - start) / (count - CHURN_WINDOW));
+  RTXStore_Free(store);
+
+  store = newRTXStoreWithBackends(backend, key_index);
+  int added = count / 10, expired = 0;
+  for (i = 0; i < added; ++i) set_element_exp(store, keys[i], strlen(keys[i]), mix_ttl());
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    char* key = (rand() % 100 < MIX_REFRESH_PERCENT || added == count) ? keys[rand() % added]
+                                                                       : keys[added++];
+    set_element_exp(store, key, strlen(key), mix_ttl());
+    if (i % MIX_EXPIRE_EVERY == 0) {
+      mstime_t now = current_time_ms();
+      while (next_at(store) != -1 && next_at(store) <= now) {
+        freeRTXElementNode(pop_next(store));
+        ++expired;
+      }
+    }
+  }
+  printf("  %-10s mix:     %8.1f ns/op (%d expired)\n", name, (now_ns() - start) / count, expired);
+  RTXStore_Free(store);
+
+  // every new key expires before the one a tick has just looked up
+  store = newRTXStoreWithBackends(backend, key_index);
+  int ahead = count < AHEAD_KEYS ? count : AHEAD_KEYS;
+  for (i = ahead; i < count; ++i)
+    set_element_exp(store, keys[i], strlen(keys[i]), AHEAD_TTL_MS + rand() % MAX_TTL_MS);
+  // the first lookup may have to find the first key, once
+  next_at(store);
+  start = now_ns();
+  for (i = 0; i < ahead; ++i) {
+    next_at(store);
+    set_element_exp(store, keys[i], strlen(keys[i]), AHEAD_TTL_MS - i);
+  }
+  printf("  %-10s ahead:   %8.1f ns/op\n", name, (now_ns() - start) / ahead);
+  RTXStore_Free(store);
+}
+
+int main(int argc, char* argv[]) {
+  int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_KEY_COUNT;
+  int long_keys;
+
+  for (long_keys = 0; long_keys <= 1; ++long_keys) {
+    srand(42);
+    char** keys = make_keys(count, long_keys);
+    printf("%d %s keys:\n", count, long_keys ? "long" : "short");
+    RTXBackend backend;
+    RTXKeyBackend key_index;
+    for (key_index = 0; key_index < RTXS_KEYS_COUNT; ++key_index)
+      for (backend = 0; backend < RTXS_BACKEND_COUNT; ++backend)
+        bench_backend(backend, key_index, keys, count);
+    int i;
+    for (i = 0; i < count; ++i) free(keys[i]);
+    free(keys);
+  }
+  return 0;
+}
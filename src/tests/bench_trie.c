@@ -0,0 +1,89 @@
+/* Micro benchmark for the trie alone: ns/op of adding, finding (hits and misses), iterating and
+ * deleting prefix heavy keys shaped like "session:{tenant}:{id}", as well as the trie's memory
+ * usage per key.
+ *
+ * usage: bench_trie.run [number of keys] [number of tenants]
+ */
+#include "../trie/triemap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_KEY_COUNT 1000000
+#define DEFAULT_TENANT_COUNT 100
+#define KEY_SIZE 48
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void keep_value(void* value) {
+  return;
+}
+
+int main(int argc, char* argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : DEFAULT_KEY_COUNT;
+  int tenants = argc > 2 ? atoi(argv[2]) : DEFAULT_TENANT_COUNT;
+  char* keys = malloc((size_t)count * KEY_SIZE);
+  tm_len_t* lens = malloc(count * sizeof(tm_len_t));
+  char miss[KEY_SIZE];
+  TrieMap* t = NewTrieMap();
+  double start;
+  long found = 0;
+  int i;
+
+  // random ids, added in random order
+  srand(42);
+  for (i = 0; i < count; ++i) {
+    lens[i] = snprintf(keys + (size_t)i * KEY_SIZE, KEY_SIZE, "session:%d:%08x%08x",
+                       rand() % tenants, rand(), rand());
+  }
+  printf("trie, %d keys over %d tenants:\n", count, tenants);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) TrieMap_Add(t, keys + (size_t)i * KEY_SIZE, lens[i], NULL, NULL);
+  printf("  add:      %8.1f ns/op, %.1f bytes/key\n", (now_ns() - start) / count,
+         (double)TrieMap_MemUsage(t) / t->cardinality);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    int k = rand() % count;
+    found += TrieMap_Find(t, keys + (size_t)k * KEY_SIZE, lens[k]) != TRIEMAP_NOTFOUND;
+  }
+  printf("  find hit: %8.1f ns/op\n", (now_ns() - start) / count);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) {
+    int k = rand() % count;
+    // same tenant, different id
+    memcpy(miss, keys + (size_t)k * KEY_SIZE, lens[k]);
+    miss[lens[k] - 1] ^= 0x40;
+    found += TrieMap_Find(t, miss, lens[k]) != TRIEMAP_NOTFOUND;
+  }
+  printf("  find miss:%8.1f ns/op\n", (now_ns() - start) / count);
+
+  start = now_ns();
+  for (i = 0; i < tenants; ++i) {
+    char prefix[32], *key;
+    tm_len_t len;
+    void* value;
+    TrieMapIterator* it = TrieMap_Iterate(t, prefix, snprintf(prefix, sizeof(prefix), "session:%d:", i));
+    while (TrieMapIterator_Next(it, &key, &len, &value)) ++found;
+    TrieMapIterator_Free(it);
+  }
+  printf("  iterate:  %8.1f ns/key\n", (now_ns() - start) / t->cardinality);
+
+  start = now_ns();
+  for (i = 0; i < count; ++i) TrieMap_Delete(t, keys + (size_t)i * KEY_SIZE, lens[i], keep_value);
+  printf("  delete:   %8.1f ns/op\n", (now_ns() - start) / count);
+
+  // keep the lookups from being optimized away
+  if (found < 0) printf("%ld\n", found);
+  TrieMap_Free(t, keep_value);
+  free(keys);
+  free(lens);
+  return 0;
+}
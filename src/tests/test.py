@@ -136,6 +136,151 @@ def test_REXECEX(redis_service):
     return retval
 
 
+# 7. MREXPIRE {key} {ttl_ms} [{key} {ttl_ms} ...]
+# 8. MRTTL {key} [{key} ...]
+def test_MREXPIRE_MRTTL(redis_service):
+    retval = False
+    ttls_ms = [10000, 20000, 30000]
+    keys = ["multi_test_key_{}".format(i) for i in range(len(ttls_ms))]
+    missing_key = "multi_test_missing_key"
+    args = []
+    for key, ttl_ms in zip(keys, ttls_ms):
+        redis_service.execute_command("SET", key, 1)
+        args += [key, ttl_ms]
+    redis_service.execute_command("DEL", missing_key)
+    replies = redis_service.execute_command("MREXPIRE", *(args + [missing_key, 1000]))
+    saved_ms = redis_service.execute_command("MRTTL", *(keys + [missing_key]))
+    if (replies != [0, 0, 0, 1]):
+        sys.stdout.write("ERROR: expected [0, 0, 0, 1] but found {}\n".format(replies))
+        retval = False
+    elif (saved_ms[-1] != -2):
+        sys.stdout.write("ERROR: expected -2 but found {}\n".format(saved_ms[-1]))
+        retval = False
+    elif (not all(compare_ms(saved, expected) for saved, expected in zip(saved_ms, ttls_ms))):
+        sys.stdout.write("ERROR: expected {} but found {}\n".format(ttls_ms, saved_ms))
+        retval = False
+    else:
+        retval = True
+
+    return retval
+
+# 1. REXPIRE {key} {ttl_ms} PRECISION {ms}
+# 3. RTTL {key}
+def test_REXPIRE_PRECISION(redis_service):
+    retval = False
+    ttl_ms = 10000
+    precision_ms = 1000
+    key = "precision_test_key"
+    redis_service.execute_command("SET", key, 1)
+    expected_at = current_time_ms() + ttl_ms
+    redis_service.execute_command("REXPIRE", key, ttl_ms, "PRECISION", precision_ms)
+    saved_at = current_time_ms() + redis_service.execute_command("RTTL", key)
+    # rounded up to a whole second
+    off_boundary = min(saved_at % precision_ms, precision_ms - saved_at % precision_ms)
+    if (saved_at < expected_at - MS_COMPARISON_ACCURACY or
+            saved_at > expected_at + precision_ms + MS_COMPARISON_ACCURACY or
+            off_boundary > MS_COMPARISON_ACCURACY):
+        sys.stdout.write("ERROR: expected expiration on a second after {} but found {}\n".format(expected_at, saved_at))
+        retval = False
+    else:
+        retval = True
+
+    return retval
+
+# RTIMERSTATS
+def test_RTIMERSTATS(redis_service):
+    retval = False
+    key = "timer_stats_test_key"
+    redis_service.execute_command("SET", key, 1)
+    redis_service.execute_command("REXPIRE", key, 10)
+    time.sleep(0.1)
+    reply = redis_service.execute_command("RTIMERSTATS")
+    stats = dict(zip(reply[::2], reply[1::2]))
+    if (redis_service.execute_command("EXISTS", key) != 0):
+        sys.stdout.write("ERROR: {} was not expired\n".format(key))
+        retval = False
+    elif (stats["wakeups"] < 1 or stats["max_latency_ns"] < stats["avg_latency_ns"]):
+        sys.stdout.write("ERROR: unexpected timer stats {}\n".format(stats))
+        retval = False
+    else:
+        retval = True
+
+    return retval
+
+# a burst larger than a tick's budget (TICK_KEYS) is expired over several ticks
+def test_tick_backlog(redis_service):
+    retval = False
+    count = 25000
+    ttl_ms = 200
+    keys = ["backlog_test_key_{}".format(i) for i in range(count)]
+    pipe = redis_service.pipeline(transaction=False)
+    for key in keys:
+        pipe.execute_command("SET", key, 1)
+    pipe.execute()
+    reply = redis_service.execute_command("RTIMERSTATS")
+    before = dict(zip(reply[::2], reply[1::2]))
+
+    args = []
+    for key in keys:
+        args += [key, ttl_ms]
+    redis_service.execute_command("MREXPIRE", *args)
+    time.sleep(1)
+    reply = redis_service.execute_command("RTIMERSTATS")
+    after = dict(zip(reply[::2], reply[1::2]))
+    left = redis_service.execute_command("EXISTS", *keys)
+    if (left != 0):
+        sys.stdout.write("ERROR: {} keys were not expired\n".format(left))
+        retval = False
+    elif (after["overruns"] <= before["overruns"] or after["expired"] - before["expired"] < count):
+        sys.stdout.write("ERROR: unexpected timer stats {}\n".format(after))
+        retval = False
+    else:
+        retval = True
+
+    return retval
+
+# keys deleted, overwritten, renamed or expired by redis keep the store in line. Every key is
+# checked on its own, with names no other test uses and TTLs outlasting the suite
+def test_keyspace_events(redis_service):
+    retval = True
+    ttl_ms = 600000
+    prefix = "keyspace_test_{}_".format(current_time_ms())
+    keys = [prefix + str(i) for i in range(5)]
+    # a key with a NUL byte, whose cancel must not touch its prefix
+    binary_key = keys[4] + "\x00b"
+    for key in keys + [binary_key]:
+        redis_service.execute_command("SET", key, 1)
+        redis_service.execute_command("REXPIRE", key, ttl_ms)
+
+    redis_service.execute_command("DEL", keys[0])
+    redis_service.execute_command("SET", keys[1], 2)
+    redis_service.execute_command("PEXPIRE", keys[2], 10)
+    redis_service.execute_command("DEL", binary_key)
+    time.sleep(0.05)
+    redis_service.execute_command("EXISTS", keys[2])
+    for key in keys[:3] + [binary_key]:
+        if (redis_service.execute_command("RTTL", key) != -2):
+            sys.stdout.write("ERROR: {!r} kept its expiration\n".format(key))
+            retval = False
+    if (redis_service.execute_command("RTTL", keys[4]) <= ttl_ms / 2):
+        sys.stdout.write("ERROR: {} lost its expiration\n".format(keys[4]))
+        retval = False
+
+    # keys[4] is replaced by keys[3], expiration included
+    redis_service.execute_command("REXPIRE", keys[3], 100)
+    redis_service.execute_command("RENAME", keys[3], keys[4])
+    saved_ms = redis_service.execute_command("RTTL", keys[4])
+    if (redis_service.execute_command("RTTL", keys[3]) != -2 or saved_ms > 100 or saved_ms < 0):
+        sys.stdout.write("ERROR: renamed key expires in {}\n".format(saved_ms))
+        retval = False
+    time.sleep(0.2)
+    if (redis_service.execute_command("EXISTS", keys[4]) != 0 or
+            redis_service.execute_command("RTTL", keys[4]) != -2):
+        sys.stdout.write("ERROR: renamed key was not expired\n")
+        retval = False
+
+    redis_service.execute_command("DEL", keys[1])
+    return retval
 
 def run_internal_test(redis_service):
     sys.stdout.write("module functional test (internal) - \n")
@@ -192,6 +337,46 @@ def function_test_rtexp(redis_service):
         sys.stdout.write("PASSED\n")
         num_of_passed_tests +=1
 
+    sys.stdout.write("\ntesting MREXPIRE_MRTTL: ")
+    if (test_MREXPIRE_MRTTL(redis_service) == False):
+        num_of_FAILED_tests +=1
+        sys.stdout.write("FAILED\n")
+    else:
+        sys.stdout.write("PASSED\n")
+        num_of_passed_tests +=1
+
+    sys.stdout.write("\ntesting REXPIRE_PRECISION: ")
+    if (test_REXPIRE_PRECISION(redis_service) == False):
+        num_of_FAILED_tests +=1
+        sys.stdout.write("FAILED\n")
+    else:
+        sys.stdout.write("PASSED\n")
+        num_of_passed_tests +=1
+
+    sys.stdout.write("\ntesting RTIMERSTATS: ")
+    if (test_RTIMERSTATS(redis_service) == False):
+        num_of_FAILED_tests +=1
+        sys.stdout.write("FAILED\n")
+    else:
+        sys.stdout.write("PASSED\n")
+        num_of_passed_tests +=1
+
+    sys.stdout.write("\ntesting tick backlog: ")
+    if (test_tick_backlog(redis_service) == False):
+        num_of_FAILED_tests +=1
+        sys.stdout.write("FAILED\n")
+    else:
+        sys.stdout.write("PASSED\n")
+        num_of_passed_tests +=1
+
+    sys.stdout.write("\ntesting keyspace events: ")
+    if (test_keyspace_events(redis_service) == False):
+        num_of_FAILED_tests +=1
+        sys.stdout.write("FAILED\n")
+    else:
+        sys.stdout.write("PASSED\n")
+        num_of_passed_tests +=1
+
     total_time_ms = current_time_ms() - start_time
     sys.stdout.write("-------------\n")
     if (num_of_FAILED_tests):
@@ -229,11 +414,56 @@ def load_test_rtexp(redis_service, timers=1000000, timeouts=[1, 10000]):#, 2, 4,
     # print "mean pull velocity =", cycles/(pull_end-gid_push_end), "per second"
     # print "mean poll velocity = ", cycles/poll_sum, "per second"
 
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+# Compare the TIMER modes: load the module with TIMER thread, then with TIMER eventloop, and run
+# this against each. Reports how late the timer woke up for the expirations (RTIMERSTATS), and
+# the round trip of a command issued while a burst of keys expires.
+def bench_timer_rtexp(redis_service, keys=200000, ttl_ms=2000, spread_ms=1000):
+    print "setting {} keys to expire over {}ms".format(keys, spread_ms)
+    pipe = redis_service.pipeline(transaction=False)
+    for i in range(keys):
+        key = "bench_timer_{}".format(i)
+        pipe.execute_command("SET", key, 1)
+        pipe.execute_command("REXPIRE", key, ttl_ms + i * spread_ms / keys)
+        if (i % 1000 == 999):
+            pipe.execute()
+    pipe.execute()
+    redis_service.execute_command("SET", "bench_timer_probe", 1)
+    reply = redis_service.execute_command("RTIMERSTATS")
+    before = dict(zip(reply[::2], reply[1::2]))
+
+    # round trips until the keys are done expiring, the probe being the one expiration left
+    latencies = []
+    give_up = time.time() + (ttl_ms + spread_ms) / 1000.0 + 10
+    while (redis_service.execute_command("RCOUNT") > 1 and time.time() < give_up):
+        start = time.time()
+        redis_service.execute_command("REXPIRE", "bench_timer_probe", 60000)
+        latencies.append((time.time() - start) * 1000000)
+    redis_service.execute_command("RUNEXPIRE", "bench_timer_probe")
+    redis_service.execute_command("DEL", "bench_timer_probe")
+
+    reply = redis_service.execute_command("RTIMERSTATS")
+    after = dict(zip(reply[::2], reply[1::2]))
+    wakeups = after["wakeups"] - before["wakeups"]
+    print "timer mode {}: {} wakeups expired {} keys, {} ticks out of budget".format(
+        after["timer"], wakeups, after["expired"] - before["expired"],
+        after["overruns"] - before["overruns"])
+    print "wakeup lateness: avg {}us, max {}us".format(
+        (after["avg_latency_ns"] * after["wakeups"] - before["avg_latency_ns"] * before["wakeups"])
+        / max(wakeups, 1) / 1000, after["max_latency_ns"] / 1000)
+    print "command round trip over {} commands: p50 {:.0f}us, p99 {:.0f}us, max {:.0f}us".format(
+        len(latencies), percentile(latencies, 50), percentile(latencies, 99), max(latencies))
+    return True
+
 if __name__ == "__main__":
     args = sys.argv[1:]
     test_internal = False
     test_external = False
     load_test = False
+    bench = False
     port = 6379
     if not args:
         test_internal = False # TODO: True?
@@ -245,6 +475,8 @@ if __name__ == "__main__":
                 port = args[i+1]
             if arg == "--load":
                 load_test = True
+            if arg == "--bench":
+                bench = True
             if arg == "--noload":
                 load_test = False
                 test_internal = True
@@ -262,3 +494,5 @@ if __name__ == "__main__":
         function_test_rtexp(r)
     if load_test:
         load_test_rtexp(r)
+    if bench:
+        bench_timer_rtexp(r)
@@ -4,19 +4,36 @@
  */
 #include "../librtexp.h"
 
+#include "../rmutil/periodic.h"
+#include "../trie/triemap.h"
+#include "../util/bucket_heap.h"
+#include "../util/deadline_heap.h"
 #include "../util/millisecond_time.h"
+#include "../util/mpsc_queue.h"
+#include "../util/radix_heap.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #define SUCCESS 0
 #define FAIL 1
 
+// the indexes the current test run is using
+static RTXBackend test_backend = RTXS_BACKEND_HEAP;
+static RTXKeyBackend test_keys = RTXS_KEYS_TRIE;
+
 // RTXStore* newRTXStore(void);
 // void RTXStore_Free(RTXStore* store);
 int constructor_distructore_test() {
   RTXStore* store = newRTXStore();
   RTXStore_Free(store);
+  store = newRTXStoreWithBackends(test_backend, test_keys);
+  RTXStore_Free(store);
   return SUCCESS;
 }
 
@@ -30,7 +47,7 @@ int test_set_element_exp() {
   mstime_t ttl_ms = 10000;
   mstime_t expected = current_time_ms() + ttl_ms;
   char* key = "set_get_test_key";
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
   if (set_element_exp(store, key, strlen(key), ttl_ms) == RTXS_ERR) return FAIL;
   retval = SUCCESS;
 
@@ -49,7 +66,7 @@ int test_set_get_element_exp() {
   mstime_t ttl_ms = 10000;
   mstime_t expected = current_time_ms() + ttl_ms;
   char* key = "set_get_test_key";
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
   if (set_element_exp(store, key, strlen(key), ttl_ms) == RTXS_ERR) return FAIL;
   mstime_t saved_ms = get_element_exp(store, key);
   if (saved_ms != expected) {
@@ -72,7 +89,7 @@ int test_del_element_exp() {
   mstime_t ttl_ms = 10000;
   mstime_t expected = -1;
   char* key = "del_test_key";
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
   if (set_element_exp(store, key, strlen(key), ttl_ms) == RTXS_ERR) return FAIL;
   if (del_element_exp(store, key) == RTXS_ERR) return FAIL;
   mstime_t saved_ms = get_element_exp(store, key);
@@ -82,6 +99,26 @@ int test_del_element_exp() {
   } else
     retval = SUCCESS;
 
+  // a key holding a NUL byte is removed by its length, leaving its prefix alone
+  set_element_exp(store, "a", 1, ttl_ms);
+  set_element_exp(store, "a\0b", 3, ttl_ms);
+  del_element_exp_len(store, "a\0b", 3);
+  if (get_element_exp(store, "a") == -1 || expiration_count(store) != 1) {
+    printf("ERROR: removing a key with a NUL byte removed its prefix\n");
+    retval = FAIL;
+  }
+  // too long to be inlined, the node's own copy is made by length too
+  char long_key[] = "a_key_too_long_to_be_inlined\0_in_its_node";
+  size_t long_len = sizeof(long_key) - 1;
+  del_element_exp_len(store, "a", 1);
+  set_element_exp(store, long_key, long_len, ttl_ms);
+  RTXElementNode* node = pop_next(store);
+  if (node == NULL || node->len != long_len || memcmp(node->key, long_key, long_len) != 0) {
+    printf("ERROR: long key with a NUL byte not kept whole\n");
+    retval = FAIL;
+  }
+  if (node) freeRTXElementNode(node);
+
   RTXStore_Free(store);
   return retval;
 }
@@ -92,7 +129,7 @@ int test_del_element_exp() {
 // mstime_t next_at(RTXStore* store);
 int test_next_at() {
   int retval = FAIL;
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
 
   mstime_t ttl_ms1 = 10000;
   char* key1 = "next_at_test_key_1";
@@ -132,7 +169,7 @@ int test_next_at() {
 // char* pop_next(RTXStore* store);
 int test_pop_next() {
   int retval = FAIL;
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
 
   mstime_t ttl_ms1 = 10000;
   char* key1 = "pop_next_test_key_1";
@@ -178,15 +215,15 @@ int test_pop_next() {
 // char* pop_wait(RTXStore* store);
 int test_pop_wait() {
   int retval = FAIL;
-  RTXStore* store = newRTXStore();
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
 
-  mstime_t ttl_ms1 = 10000;
+  mstime_t ttl_ms1 = 1000;
   char* key1 = "pop_next_test_key_1";
 
-  mstime_t ttl_ms2 = 2000;
+  mstime_t ttl_ms2 = 20;
   char* key2 = "pop_next_test_key_2";
 
-  mstime_t ttl_ms3 = 3000;
+  mstime_t ttl_ms3 = 30;
   char* key3 = "pop_next_test_key_3";
 
   if ((set_element_exp(store, key1, strlen(key1), ttl_ms1) != RTXS_ERR) &&
@@ -200,7 +237,9 @@ int test_pop_wait() {
     RTXElementNode* actual_node = pop_wait(store);
     char* pulled_key = actual_node->key;
     mstime_t actual_ms = current_time_ms() - start_time;
-    if (expected_ms == actual_ms) {
+    // slept until key3's deadline, give or take the clock's rounding
+    if (actual_ms < expected_ms - 2 || actual_ms > expected_ms + 20 ||
+        strcmp(pulled_key, expected_key) != 0) {
       printf("ERROR: expected %llu but found %llu\n", expected_ms, actual_ms);
       retval = FAIL;
     } else {
@@ -219,65 +258,1298 @@ int test_pop_wait() {
   return retval;
 }
 
-int main(int argc, char* argv[]) {
-  mstime_t start_time = current_time_ms();
-  int num_of_failed_tests = 0;
-  int num_of_passed_tests = 0;
+/*
+ * Re-expiring a key reschedules its single entry in place, both earlier and later
+ */
+int test_reschedule_in_place() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char* key1 = "reschedule_test_key_1";
+  char* key2 = "reschedule_test_key_2";
+  int i;
 
-  if (constructor_distructore_test() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on constructor-distructore\n");
-  } else {
-    printf("PASSED constructor-distructore test\n");
-    ++num_of_passed_tests;
+  for (i = 0; i < 1000; ++i) {
+    if (set_element_exp(store, key1, strlen(key1), 1000 + i) == RTXS_ERR) retval = FAIL;
+  }
+  if (set_element_exp(store, key2, strlen(key2), 2000) == RTXS_ERR) retval = FAIL;
+  if (expiration_count(store) != 2) {
+    printf("ERROR: expected 2 entries but found %zu\n", expiration_count(store));
+    retval = FAIL;
   }
 
-  if (test_set_element_exp() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on set\n");
-  } else {
-    printf("PASSED set test\n");
-    ++num_of_passed_tests;
+  // increase key: key2 is now the closest
+  mstime_t expected = current_time_ms() + 2000;
+  if (set_element_exp(store, key1, strlen(key1), 5000) == RTXS_ERR) retval = FAIL;
+  if (next_at(store) != expected) {
+    printf("ERROR: expected %llu but found %llu\n", expected, next_at(store));
+    retval = FAIL;
   }
 
-  if (test_set_get_element_exp() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on set-get\n");
-  } else {
-    printf("PASSED set-get test\n");
-    ++num_of_passed_tests;
+  // decrease key: key1 is the closest again
+  expected = current_time_ms() + 10;
+  if (set_element_exp(store, key1, strlen(key1), 10) == RTXS_ERR) retval = FAIL;
+  if (next_at(store) != expected) {
+    printf("ERROR: expected %llu but found %llu\n", expected, next_at(store));
+    retval = FAIL;
   }
 
-  if (test_del_element_exp() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on del\n");
-  } else {
-    printf("PASSED del test\n");
-    ++num_of_passed_tests;
+  // cancel removes the entry right away
+  del_element_exp(store, key1);
+  del_element_exp(store, key2);
+  if (expiration_count(store) != 0 || next_at(store) != -1) {
+    printf("ERROR: expected an empty store but found %zu entries\n", expiration_count(store));
+    retval = FAIL;
   }
 
-  if (test_pop_next() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on pop_next\n");
-  } else {
-    printf("PASSED pop_next test\n");
-    ++num_of_passed_tests;
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Updating only works for keys already in the store, and changes their node in place
+ */
+int test_update_element_exp() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char* key = "update_test_key";
+  char* missing_key = "update_test_missing_key";
+
+  if (update_element_exp(store, missing_key, strlen(missing_key), 1000) != RTXS_ERR ||
+      expiration_count(store) != 0) {
+    printf("ERROR: updated a key with no expiration\n");
+    retval = FAIL;
   }
 
-  if (test_next_at() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on next_at\n");
-  } else {
-    printf("PASSED next_at test\n");
-    ++num_of_passed_tests;
+  set_element_exp(store, key, strlen(key), 1000);
+  mstime_t expected = current_time_ms() + 3000;
+  if (update_element_exp(store, key, strlen(key), 3000) != RTXS_OK ||
+      get_element_exp(store, key) != expected) {
+    printf("ERROR: expected %llu but found %llu\n", expected, get_element_exp(store, key));
+    retval = FAIL;
   }
 
-  if (test_pop_wait() == FAIL) {
-    ++num_of_failed_tests;
-    printf("FAILED on pop_wait\n");
-  } else {
-    printf("PASSED pop_wait\n");
-    ++num_of_passed_tests;
+  RTXElementNode* node = pop_next(store);
+  if (node->exp.version != 1 || expiration_count(store) != 0) {
+    printf("ERROR: expected version 1 but found %d\n", node->exp.version);
+    retval = FAIL;
+  }
+  freeRTXElementNode(node);
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Short keys live inside their node, long keys are allocated, and popped nodes can be retained
+ */
+int test_node_keys() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char* short_key = "node_key_short";
+  char* long_key = "node_key_long_enough_not_to_fit_inside_of_the_node";
+
+  if ((set_element_exp(store, short_key, strlen(short_key), 1000) == RTXS_ERR) ||
+      (set_element_exp(store, long_key, strlen(long_key), 2000) == RTXS_ERR)) {
+    RTXStore_Free(store);
+    return FAIL;
+  }
+
+  RTXElementNode* node = pop_next(store);
+  if (strcmp(node->key, short_key) || node->len != strlen(short_key) ||
+      node->key != node->inline_key) {
+    printf("ERROR: expected inline key \'%s\' but found \'%s\'\n", short_key, node->key);
+    retval = FAIL;
+  }
+  freeRTXElementNode(node);
+
+  node = pop_next(store);
+  if (strcmp(node->key, long_key) || node->len != strlen(long_key)) {
+    printf("ERROR: expected key \'%s\' but found \'%s\'\n", long_key, node->key);
+    retval = FAIL;
+  }
+  retainRTXElementNode(node);
+  freeRTXElementNode(node);
+  if (strcmp(node->key, long_key)) {  // still alive on the second reference
+    printf("ERROR: retained node was freed\n");
+    retval = FAIL;
+  }
+  freeRTXElementNode(node);
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Under a mix of new keys, refreshes, removals and pops the ordering structure never holds more
+ * entries than there are keys with an expiration
+ */
+int test_no_stale_entries() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char key[32];
+  int i;
+
+  srand(7);
+  for (i = 0; i < 20000; ++i) {
+    sprintf(key, "stale_test_key_%d", rand() % 1000);
+    switch (rand() % 4) {
+      case 0:
+        del_element_exp(store, key);
+        break;
+      case 1: {
+        RTXElementNode* node = pop_next(store);
+        if (node) freeRTXElementNode(node);
+        break;
+      }
+      default:
+        set_element_exp(store, key, strlen(key), rand() % 100000);
+    }
+    if (expiration_count(store) != store->key_type->count(store->key_index)) {
+      printf("ERROR: %zu entries for %zu keys\n", expiration_count(store),
+             store->key_type->count(store->key_index));
+      retval = FAIL;
+      break;
+    }
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Pop everything out of a store holding TTLs from a few milliseconds up to a day and make sure
+ * the keys come out sorted by expiration
+ */
+int test_pop_order() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char key[32];
+  int i, count = 5000;
+
+  srand(42);
+  for (i = 0; i < count; ++i) {
+    mstime_t ttl_ms = (i % 3) ? rand() % 86400000 : rand() % 100;
+    sprintf(key, "pop_order_key_%d", i);
+    if (set_element_exp(store, key, strlen(key), ttl_ms) == RTXS_ERR) retval = FAIL;
+  }
+
+  mstime_t last = -1;
+  int popped = 0;
+  RTXElementNode* node;
+  while ((node = pop_next(store)) != NULL) {
+    if (node->exp.time < last) {
+      printf("ERROR: popped %llu after %llu\n", node->exp.time, last);
+      retval = FAIL;
+    }
+    last = node->exp.time;
+    ++popped;
+    freeRTXElementNode(node);
+  }
+  if (popped != count) {
+    printf("ERROR: expected %d keys but popped %d\n", count, popped);
+    retval = FAIL;
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Reschedule and delete random keys, moving nodes both up and down and out of the middle of the
+ * ordering structure, then make sure the remaining keys still come out sorted by expiration
+ */
+int test_mixed_updates_order() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char key[32];
+  int i, count = 5000, deleted = 0;
+
+  srand(7);
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "mixed_key_%d", i);
+    set_element_exp(store, key, strlen(key), rand() % 86400000);
+  }
+  for (i = 0; i < 3 * count; ++i) {
+    sprintf(key, "mixed_key_%d", rand() % count);
+    if (i % 4 == 0) {
+      if (get_element_exp(store, key) != -1) ++deleted;
+      del_element_exp(store, key);
+    } else {
+      update_element_exp(store, key, strlen(key), rand() % 86400000);
+    }
+  }
+
+  mstime_t last = -1;
+  int popped = 0;
+  RTXElementNode* node;
+  while ((node = pop_next(store)) != NULL) {
+    if (node->exp.time < last) {
+      printf("ERROR: popped %llu after %llu\n", node->exp.time, last);
+      retval = FAIL;
+    }
+    last = node->exp.time;
+    ++popped;
+    freeRTXElementNode(node);
+  }
+  if (popped != count - deleted) {
+    printf("ERROR: expected %d keys but popped %d\n", count - deleted, popped);
+    retval = FAIL;
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Grow the deadline heap over many chunks, drain it and make sure it comes out sorted and gives
+ * its chunks back
+ */
+int test_deadline_heap_chunks() {
+  int retval = SUCCESS;
+  dheap_t* h = dheap_new(DHEAP_NO_IDX);
+  size_t empty_usage = dheap_memusage(h);
+  long i, count = 10 * DHEAP_CHUNK_SIZE;
+
+  srand(3);
+  for (i = 0; i < count; ++i) dheap_offer(h, rand() % 1000, (void*)(i + 1));
+  if (dheap_memusage(h) <= empty_usage + 9 * DHEAP_CHUNK_SIZE * sizeof(dheap_entry_t)) {
+    printf("ERROR: %ld entries only take %zu bytes\n", count, dheap_memusage(h));
+    retval = FAIL;
+  }
+
+  long long last = -1;
+  for (i = 0; i < count; ++i) {
+    long long deadline = dheap_peek_deadline(h);
+    if (deadline < last || dheap_poll(h) == NULL) {
+      printf("ERROR: bad poll #%ld, deadline %lld after %lld\n", i, deadline, last);
+      retval = FAIL;
+      break;
+    }
+    last = deadline;
+  }
+  if (dheap_count(h) != 0 || dheap_poll(h) != NULL) retval = FAIL;
+  // one spare chunk is kept around
+  if (dheap_memusage(h) >= empty_usage + 2 * DHEAP_CHUNK_SIZE * sizeof(dheap_entry_t)) {
+    printf("ERROR: drained heap still holds %zu bytes\n", dheap_memusage(h));
+    retval = FAIL;
+  }
+
+  dheap_free(h);
+  return retval;
+}
+
+/*
+ * Pop a key ahead of its time, then add keys expiring before it. The wheel and the radix heap
+ * both assume nothing earlier than the last popped key comes in, and have to re-base
+ */
+int test_offer_before_popped() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char* expected[] = {"early_key", "later_key", "far_key"};
+  int i;
+
+  set_element_exp(store, "far_key", strlen("far_key"), 5000);
+  set_element_exp(store, "first_key", strlen("first_key"), 3000);
+  freeRTXElementNode(pop_next(store));
+  set_element_exp(store, "later_key", strlen("later_key"), 200);
+  set_element_exp(store, "early_key", strlen("early_key"), 100);
+
+  for (i = 0; i < 3; ++i) {
+    RTXElementNode* node = pop_next(store);
+    if (node == NULL || strcmp(node->key, expected[i]) != 0) {
+      printf("ERROR: expected %s but popped %s\n", expected[i], node ? node->key : "nothing");
+      retval = FAIL;
+    }
+    if (node) freeRTXElementNode(node);
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Expire a batch as large as the store (rebuilding the heap), then a small one (sifting), with
+ * keys already in the store and a key given twice in the same batch
+ */
+int test_set_element_exp_batch() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char* keys[1002];
+  size_t lens[1002];
+  mstime_t ttls[1002];
+  char key[32];
+  int i, count = 1000;
+
+  srand(7);
+  for (i = 0; i < 100; ++i) {
+    sprintf(key, "batch_key_%d", i);
+    set_element_exp(store, key, strlen(key), 5000);
+  }
+  // batch_key_0 .. 99 are refreshed, the rest are new
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "batch_key_%d", i);
+    keys[i] = strdup(key);
+    lens[i] = strlen(key);
+    ttls[i] = 1000 + rand() % 86400000;
+  }
+  keys[count] = strdup("batch_key_500");
+  lens[count] = strlen(keys[count]);
+  ttls[count] = 10;
+  keys[count + 1] = strdup("batch_key_0");
+  lens[count + 1] = strlen(keys[count + 1]);
+  ttls[count + 1] = 20;
+  if (set_element_exp_batch(store, keys, lens, ttls, count + 2) != RTXS_OK) retval = FAIL;
+
+  // a small batch next to the keys already there
+  for (i = 0; i < 10; ++i) {
+    free(keys[i]);
+    sprintf(key, "small_batch_key_%d", i);
+    keys[i] = strdup(key);
+    lens[i] = strlen(key);
+    ttls[i] = rand() % 86400000;
+  }
+  if (set_element_exp_batch(store, keys, lens, ttls, 10) != RTXS_OK) retval = FAIL;
+  del_element_exp(store, "batch_key_700");
+
+  if (expiration_count(store) != count + 9) {
+    printf("ERROR: expected %d keys but the store holds %zu\n", count + 9, expiration_count(store));
+    retval = FAIL;
+  }
+
+  char* expected[] = {"batch_key_500", "batch_key_0"};
+  mstime_t last = -1;
+  int popped = 0;
+  RTXElementNode* node;
+  while ((node = pop_next(store)) != NULL) {
+    if (popped < 2 && strcmp(node->key, expected[popped]) != 0) {
+      printf("ERROR: expected %s but popped %s\n", expected[popped], node->key);
+      retval = FAIL;
+    }
+    if (node->exp.time < last || strcmp(node->key, "batch_key_700") == 0) {
+      printf("ERROR: popped %s at %llu after %llu\n", node->key, node->exp.time, last);
+      retval = FAIL;
+    }
+    last = node->exp.time;
+    ++popped;
+    freeRTXElementNode(node);
+  }
+  if (popped != count + 9) {
+    printf("ERROR: expected %d keys but popped %d\n", count + 9, popped);
+    retval = FAIL;
+  }
+
+  for (i = 0; i < count + 2; ++i) free(keys[i]);
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Drain the due keys in batches smaller than their number, leaving the later ones in the store
+ */
+int test_pop_due() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  RTXElementNode* out[16];
+  char key[32];
+  int i, due = 100, count = 150;
+
+  srand(11);
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "pop_due_key_%d", i);
+    set_element_exp(store, key, strlen(key), (i < due) ? -(rand() % 1000) - 1 : 100000);
+  }
+
+  mstime_t now = current_time_ms(), last = -1;
+  size_t n;
+  int popped = 0;
+  while ((n = pop_due(store, now, out, 16)) > 0) {
+    for (i = 0; i < n; ++i) {
+      if (out[i]->exp.time < last || out[i]->exp.time > now ||
+          get_element_exp(store, out[i]->key) != -1) {
+        printf("ERROR: popped %s at %llu after %llu\n", out[i]->key, out[i]->exp.time, last);
+        retval = FAIL;
+      }
+      last = out[i]->exp.time;
+      freeRTXElementNode(out[i]);
+    }
+    popped += n;
+  }
+  if (popped != due || expiration_count(store) != count - due) {
+    printf("ERROR: popped %d due keys out of %d, %zu left\n", popped, due, expiration_count(store));
+    retval = FAIL;
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * A renamed key keeps its expiration under its new name, replacing the new name's own, and a key
+ * claimed under its old name is expired under its new one
+ */
+int test_rename_element_exp() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  RTXElementNode* out[4];
+  int versions[4];
+
+  set_element_exp(store, "rename_from", 11, 10000);
+  set_element_exp(store, "rename_to", 9, 20000);
+  mstime_t from_exp = get_element_exp(store, "rename_from");
+  if (rename_element_exp(store, "rename_from", 11, "rename_to", 9) != RTXS_OK ||
+      get_element_exp(store, "rename_from") != -1 ||
+      get_element_exp(store, "rename_to") != from_exp || expiration_count(store) != 1 ||
+      next_at(store) != from_exp) {
+    printf("ERROR: renamed key expires at %llu, not %llu\n", get_element_exp(store, "rename_to"),
+           from_exp);
+    retval = FAIL;
+  }
+  // a key without an expiration takes the new name's away, like redis deletes it
+  if (rename_element_exp(store, "no_expiration", 13, "rename_to", 9) != RTXS_ERR ||
+      expiration_count(store) != 0 || next_at(store) != -1) {
+    printf("ERROR: renaming a key without an expiration left %zu\n", expiration_count(store));
+    retval = FAIL;
+  }
+
+  set_element_exp(store, "claimed_from", 12, -1);
+  if (claim_due(store, current_time_ms(), out, versions, 4) != 1) {
+    printf("ERROR: due key not claimed\n");
+    RTXStore_Free(store);
+    return FAIL;
+  }
+  // a longer name than fits the node, so the key moves out of it
+  char* long_name = "claimed_to_a_name_longer_than_an_inline_key";
+  rename_element_exp(store, "claimed_from", 12, long_name, strlen(long_name));
+  if (get_element_exp(store, long_name) != out[0]->exp.time ||
+      claim_due(store, current_time_ms(), out + 1, versions + 1, 3) != 0 ||
+      expire_claimed(store, out[0], versions[0]) != RTXS_OK || strcmp(out[0]->key, long_name) != 0 ||
+      expiration_count(store) != 0) {
+    printf("ERROR: claimed key not expired under its new name\n");
+    retval = FAIL;
+  }
+  freeRTXElementNode(out[0]);
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Claimed keys stay known by key until they are expired, and keys refreshed or removed since they
+ * were claimed are not expired
+ */
+int test_claim_due() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  RTXElementNode* out[128];
+  RTXElementNode* again[4];
+  int versions[128], again_versions[4];
+  char key[32];
+  int i, due = 100, count = 150;
+
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "claim_key_%d", i);
+    set_element_exp(store, key, strlen(key), (i < due) ? -i - 1 : 100000);
+  }
+
+  mstime_t now = current_time_ms();
+  size_t n = claim_due(store, now, out, versions, 128);
+  if (n != due || expiration_count(store) != count || next_at(store) <= now ||
+      get_element_exp(store, out[0]->key) == -1) {
+    printf("ERROR: claimed %zu of %d due keys, %zu keys left\n", n, due, expiration_count(store));
+    RTXStore_Free(store);
+    return FAIL;
+  }
+
+  // refreshed, removed, and refreshed to be due again, after being claimed
+  set_element_exp(store, out[0]->key, out[0]->len, 100000);
+  del_element_exp(store, out[1]->key);
+  set_element_exp(store, out[2]->key, out[2]->len, -1);
+  if (claim_due(store, now, again, again_versions, 4) != 1 || again[0] != out[2]) {
+    printf("ERROR: refreshed claimed key not claimed again\n");
+    retval = FAIL;
+  }
+
+  for (i = 0; i < n; ++i) {
+    int res = expire_claimed(store, out[i], versions[i]);
+    if (res != ((i < 3) ? RTXS_ERR : RTXS_OK)) {
+      printf("ERROR: claimed key %s expired: %d\n", out[i]->key, res == RTXS_OK);
+      retval = FAIL;
+    }
+    if (i >= 3 && get_element_exp(store, out[i]->key) != -1) {
+      printf("ERROR: expired key %s still in the store\n", out[i]->key);
+      retval = FAIL;
+    }
+  }
+  if (expire_claimed(store, again[0], again_versions[0]) != RTXS_OK ||
+      get_element_exp(store, out[0]->key) == -1 || get_element_exp(store, out[1]->key) != -1 ||
+      get_element_exp(store, out[2]->key) != -1) {
+    printf("ERROR: refreshed and removed keys not kept as set\n");
+    retval = FAIL;
+  }
+  freeRTXElementNode(again[0]);
+  for (i = 0; i < n; ++i) freeRTXElementNode(out[i]);
+
+  if (expiration_count(store) != count - due + 1 || next_at(store) <= now) {
+    printf("ERROR: %zu keys left after expiring the claimed ones\n", expiration_count(store));
+    retval = FAIL;
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+/*
+ * Deadlines are rounded up to the store's precision, or to the one given per key, and keys set
+ * within the same window share a deadline
+ */
+int test_set_element_exp_precision() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  char key[32];
+  int i, count = 50;
+
+  if (RTXStore_SetPrecision(store, 0) != RTXS_ERR || RTXStore_SetPrecision(store, 50) != RTXS_OK) {
+    printf("ERROR: precision not validated\n");
+    retval = FAIL;
+  }
+
+  mstime_t before = current_time_ms();
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "precision_key_%d", i);
+    set_element_exp(store, key, strlen(key), 1000 + i);
+  }
+  set_element_exp_precision(store, "exact_key", 9, 1000, 1);
+  set_element_exp_precision(store, "coarse_key", 10, 1000, 1000);
+  mstime_t after = current_time_ms();
+
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "precision_key_%d", i);
+    mstime_t exp = get_element_exp(store, key);
+    if (exp % 50 != 0 || exp < before + 1000 + i || exp >= after + 1000 + i + 50) {
+      printf("ERROR: %s expires at %llu, not rounded to 50ms\n", key, exp);
+      retval = FAIL;
+    }
+  }
+  mstime_t exact = get_element_exp(store, "exact_key");
+  mstime_t coarse = get_element_exp(store, "coarse_key");
+  if (exact < before + 1000 || exact > after + 1000 || coarse % 1000 != 0 ||
+      coarse < before + 1000 || coarse >= after + 2000) {
+    printf("ERROR: exact key expires at %llu, coarse key at %llu\n", exact, coarse);
+    retval = FAIL;
+  }
+
+  // refreshing a key rounds its new deadline too
+  update_element_exp(store, "exact_key", 9, 2000);
+  if (get_element_exp(store, "exact_key") % 50 != 0) {
+    printf("ERROR: refreshed key expires at %llu\n", get_element_exp(store, "exact_key"));
+    retval = FAIL;
+  }
+
+  if (test_backend == RTXS_BACKEND_BUCKET) {
+    // 50 deadlines spread over 50ms fall into at most 3 windows, plus the 2 other keys
+    unsigned int buckets = bheap_bucket_count(store->deadline_index);
+    if (buckets > 5) {
+      printf("ERROR: %d keys in %u buckets\n", count + 2, buckets);
+      retval = FAIL;
+    }
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+typedef struct {
+  long long deadline;
+  bheap_link_t link;
+} bucket_test_item;
+
+/*
+ * Items sharing a deadline share a bucket, through removes from the middle of a bucket and
+ * drains splitting a bucket
+ */
+int test_bucket_heap() {
+  int retval = SUCCESS;
+  bucket_heap_t* h = bheap_new(offsetof(bucket_test_item, link));
+  bucket_test_item items[1000];
+  void* out[64];
+  int i, count = 1000;
+
+  for (i = 0; i < count; ++i) {
+    items[i].deadline = 100 * (i % 3);
+    bheap_offer(h, items[i].deadline, &items[i]);
+  }
+  if (bheap_bucket_count(h) != 3 || bheap_count(h) != count) {
+    printf("ERROR: %u items in %u buckets\n", bheap_count(h), bheap_bucket_count(h));
+    retval = FAIL;
+  }
+
+  // every other item due at 0, then all of them due at 100
+  for (i = 0; i < count; i += 6) bheap_remove(h, &items[i]);
+  for (i = 1; i < count; i += 3) bheap_remove(h, &items[i]);
+  if (bheap_bucket_count(h) != 2) {
+    printf("ERROR: %u buckets left\n", bheap_bucket_count(h));
+    retval = FAIL;
+  }
+
+  long long last = -1;
+  int popped = 0;
+  unsigned int n;
+  while ((n = bheap_poll_due(h, 150, out, 64)) > 0) {
+    for (i = 0; i < n; ++i) {
+      bucket_test_item* item = out[i];
+      if (item->deadline < last || item->deadline > 150 || (item - items) % 6 == 0) {
+        printf("ERROR: drained item %ld at %lld after %lld\n", (long)(item - items), item->deadline,
+               last);
+        retval = FAIL;
+      }
+      last = item->deadline;
+    }
+    popped += n;
+  }
+  if (popped != 167 || bheap_count(h) != 333 || bheap_peek(h) == NULL ||
+      ((bucket_test_item*)bheap_poll(h))->deadline != 200) {
+    printf("ERROR: drained %d items, %u left\n", popped, bheap_count(h));
+    retval = FAIL;
+  }
+
+  bheap_free(h);
+  return retval;
+}
+
+void _keep_value(void* value) { return; }
+
+/*
+ * Grow trie nodes through every size and back, with keys that are prefixes of other keys
+ */
+int test_trie_nodes() {
+  int retval = SUCCESS;
+  TrieMap* t = NewTrieMap();
+  char key[32];
+  int i, len, found;
+
+  // 256 children below "session:7:", most of them with a key of their own below
+  for (i = 0; i < 512; ++i) {
+    len = sprintf(key, "session:7:%c%d", i % 256, i / 256);
+    TrieMap_Add(t, key, len, (void*)(long)(i + 1), NULL);
+  }
+  TrieMap_Add(t, "session:7:", strlen("session:7:"), NULL, NULL);
+  TrieMap_Add(t, "session:", strlen("session:"), NULL, NULL);
+  if (t->cardinality != 514) {
+    printf("ERROR: trie holds %zu keys\n", t->cardinality);
+    retval = FAIL;
+  }
+  for (i = 0; i < 512; ++i) {
+    len = sprintf(key, "session:7:%c%d", i % 256, i / 256);
+    if (TrieMap_Find(t, key, len) != (void*)(long)(i + 1)) {
+      printf("ERROR: could not find key #%d\n", i);
+      retval = FAIL;
+    }
+  }
+  if (TrieMap_Find(t, "session:7", strlen("session:7")) != TRIEMAP_NOTFOUND ||
+      TrieMap_Find(t, "session:7:", strlen("session:7:")) != NULL) {
+    printf("ERROR: found a key that was never added\n");
+    retval = FAIL;
+  }
+
+  // remove one key of every child until the node is back to 4 children
+  for (i = 0; i < 254; ++i) {
+    len = sprintf(key, "session:7:%c0", i % 256);
+    TrieMap_Delete(t, key, len, _keep_value);
+    len = sprintf(key, "session:7:%c1", i % 256);
+    TrieMap_Delete(t, key, len, _keep_value);
+  }
+  TrieMap_Delete(t, "session:", strlen("session:"), _keep_value);
+
+  TrieMapIterator* it = TrieMap_Iterate(t, "session:7:", strlen("session:7:"));
+  char* ptr;
+  tm_len_t plen;
+  void* value;
+  for (found = 0; TrieMapIterator_Next(it, &ptr, &plen, &value); ++found) {
+    if (plen > 10 && (unsigned char)ptr[10] < 254) {
+      printf("ERROR: iterated over a deleted key\n");
+      retval = FAIL;
+    }
+  }
+  TrieMapIterator_Free(it);
+  if (found != 5 || t->cardinality != 5) {
+    printf("ERROR: iterated %d keys, trie holds %zu\n", found, t->cardinality);
+    retval = FAIL;
+  }
+
+  char* random_key;
+  if (!TrieMap_RandomKey(t, &random_key, &plen, &value) || strncmp(random_key, "session:7:", 10)) {
+    printf("ERROR: bad random key\n");
+    retval = FAIL;
+  } else {
+    free(random_key);
+  }
+
+  TrieMap_Free(t, _keep_value);
+  return retval;
+}
+
+void _count_node(RTXElementNode* node, void* count) {
+  ++*(int*)count;
+}
+
+/*
+ * Walk both indexes of a store through their function tables, and look backends up by name
+ */
+int test_backend_interface() {
+  int retval = SUCCESS;
+  RTXStore* store = newRTXStoreWithBackends(test_backend, test_keys);
+  size_t empty_usage = RTXStore_MemUsage(store);
+  char key[32];
+  int i, count = 100, deadlines = 0, keys = 0;
+
+  for (i = 0; i < count; ++i) {
+    sprintf(key, "interface_key_%d", i);
+    set_element_exp(store, key, strlen(key), i * 10);
+  }
+  store->deadline_type->iterate(store->deadline_index, _count_node, &deadlines);
+  store->key_type->iterate(store->key_index, _count_node, &keys);
+  if (deadlines != count || keys != count) {
+    printf("ERROR: iterated %d deadlines and %d keys out of %d\n", deadlines, keys, count);
+    retval = FAIL;
+  }
+  if (RTXStore_MemUsage(store) <= empty_usage) {
+    printf("ERROR: store still takes %zu bytes\n", RTXStore_MemUsage(store));
+    retval = FAIL;
+  }
+
+  RTXBackend backend;
+  if (RTXBackend_FromName(store->deadline_type->name, &backend) != RTXS_OK ||
+      backend != test_backend || RTXBackend_FromName("nosuchbackend", &backend) != RTXS_ERR) {
+    printf("ERROR: could not look up backend %s\n", store->deadline_type->name);
+    retval = FAIL;
+  }
+
+  RTXStore_Free(store);
+  return retval;
+}
+
+void _count_timer_run(RedisModuleCtx* ctx, void* runs) {
+  __sync_fetch_and_add((int*)runs, 1);
+}
+
+struct timespec _monotonic_in(long ms) {
+  struct timespec at;
+  clock_gettime(CLOCK_MONOTONIC, &at);
+  at.tv_sec += ms / 1000;
+  at.tv_nsec += (ms % 1000) * 1000000;
+  if (at.tv_nsec >= 1000000000) {
+    at.tv_sec++;
+    at.tv_nsec -= 1000000000;
+  }
+  return at;
+}
+
+/*
+ * The deadline timer parks without a deadline, is woken early by a nearer deadline but not by a
+ * later one, and runs once per deadline
+ */
+int test_deadline_timer() {
+  int retval = SUCCESS;
+  volatile int runs = 0;
+  struct RMUtilTimer* tm = RMUtil_NewDeadlineTimer(_count_timer_run, NULL, (void*)&runs);
+
+  usleep(20000);
+  if (runs != 0) {
+    printf("ERROR: timer ran %d times without a deadline\n", runs);
+    retval = FAIL;
+  }
+
+  RMUtilTimer_WakeAt(tm, _monotonic_in(10000));
+  RMUtilTimer_WakeAt(tm, _monotonic_in(30));
+  RMUtilTimer_WakeAt(tm, _monotonic_in(5000));
+  usleep(15000);
+  if (runs != 0) {
+    printf("ERROR: timer ran ahead of its deadline\n");
+    retval = FAIL;
+  }
+  usleep(100000);
+  if (runs != 1) {
+    printf("ERROR: timer ran %d times for a single deadline\n", runs);
+    retval = FAIL;
+  }
+
+  // a deadline already passed runs right away
+  RMUtilTimer_WakeAt(tm, _monotonic_in(0));
+  usleep(20000);
+  if (runs != 2) {
+    printf("ERROR: timer ran %d times after a passed deadline\n", runs);
+    retval = FAIL;
+  }
+
+  RMUtilTimerStats stats;
+  RMUtilTimer_GetStats(tm, &stats);
+  if (stats.runs != 2 || stats.lastLatencyNs < 0 || stats.maxLatencyNs < stats.lastLatencyNs ||
+      stats.totalLatencyNs < stats.maxLatencyNs || stats.earlyWakeNs != 0) {
+    printf("ERROR: %llu runs, %lld/%lld/%lldns last/max/total latency\n", stats.runs,
+           stats.lastLatencyNs, stats.maxLatencyNs, stats.totalLatencyNs);
+    retval = FAIL;
+  }
+
+  RMUtilTimer_Terminate(tm);
+  usleep(10000);
+  return retval;
+}
+
+typedef struct {
+  struct RMUtilTimer* tm;
+  volatile int runs;
+} spin_test_ctx;
+
+void _rearm_timer_run(RedisModuleCtx* ctx, void* p) {
+  spin_test_ctx* spin = p;
+  if (++spin->runs < 250) RMUtilTimer_WakeAt(spin->tm, _monotonic_in(1));
+}
+
+/*
+ * A spinning timer learns how much it oversleeps and wakes up that much early, never more than
+ * it may spin for
+ */
+int test_timer_spin() {
+  int retval = SUCCESS;
+  long long max_spin_ns = 200000;
+  spin_test_ctx spin = {NULL, 0};
+  spin.tm = RMUtil_NewDeadlineTimer(_rearm_timer_run, NULL, &spin);
+  RMUtilTimer_SetSpin(spin.tm, max_spin_ns);
+
+  RMUtilTimer_WakeAt(spin.tm, _monotonic_in(1));
+  int i;
+  for (i = 0; i < 200 && spin.runs < 250; ++i) usleep(10000);
+
+  RMUtilTimerStats stats;
+  RMUtilTimer_GetStats(spin.tm, &stats);
+  if (spin.runs != 250 || stats.earlyWakeNs <= 0 || stats.earlyWakeNs > max_spin_ns) {
+    printf("ERROR: %d runs, waking up %lldns early\n", spin.runs, stats.earlyWakeNs);
+    retval = FAIL;
+  }
+
+  RMUtilTimer_Terminate(spin.tm);
+  usleep(10000);
+  return retval;
+}
+
+/*
+ * The timer's thread can be pinned and rescheduled while it runs, or refuses a real-time policy
+ * for lack of privileges
+ */
+int test_timer_scheduling() {
+  int retval = SUCCESS;
+  volatile int runs = 0;
+  struct RMUtilTimer* tm = RMUtil_NewDeadlineTimer(_count_timer_run, NULL, (void*)&runs);
+  int cpus[] = {0};
+  int bad_cpus[] = {-1};
+
+  int fifo = RMUtilTimer_SetScheduling(tm, SCHED_FIFO, sched_get_priority_min(SCHED_FIFO));
+  if ((fifo != 0 && fifo != EPERM) || RMUtilTimer_SetScheduling(tm, SCHED_OTHER, 0) != 0 ||
+      RMUtilTimer_SetScheduling(tm, SCHED_OTHER, 99) == 0) {
+    printf("ERROR: could not reschedule the timer's thread\n");
+    retval = FAIL;
+  }
+  if (RMUtilTimer_SetAffinity(tm, cpus, 1) != 0 || RMUtilTimer_SetAffinity(tm, bad_cpus, 1) == 0) {
+    printf("ERROR: could not pin the timer's thread\n");
+    retval = FAIL;
+  }
+
+  // still running
+  RMUtilTimer_WakeAt(tm, _monotonic_in(0));
+  usleep(20000);
+  if (runs != 1) {
+    printf("ERROR: timer ran %d times after rescheduling\n", runs);
+    retval = FAIL;
+  }
+
+  RMUtilTimer_Terminate(tm);
+  usleep(10000);
+  return retval;
+}
+
+/*
+ * A periodic timer runs every interval, and a new interval takes effect right away
+ */
+int test_periodic_timer() {
+  int retval = SUCCESS;
+  volatile int runs = 0;
+  struct RMUtilTimer* tm = RMUtil_NewPeriodicTimer(_count_timer_run, NULL, (void*)&runs,
+                                                   (struct timespec){.tv_sec = 0, .tv_nsec = 10000000});
+
+  usleep(105000);
+  RMUtilTimer_SetInterval(tm, (struct timespec){.tv_sec = 10, .tv_nsec = 0});
+  usleep(1000);
+  int ran = runs;
+  if (ran < 5 || ran > 11) {
+    printf("ERROR: 10ms timer ran %d times in 105ms\n", ran);
+    retval = FAIL;
+  }
+
+  usleep(30000);
+  if (runs != ran) {
+    printf("ERROR: timer ran %d more times after slowing down\n", runs - ran);
+    retval = FAIL;
+  }
+
+  RMUtilTimer_Terminate(tm);
+  usleep(10000);
+  return retval;
+}
+
+void run_suite(int* num_of_failed_tests, int* num_of_passed_tests) {
+  if (constructor_distructore_test() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on constructor-distructore\n");
+  } else {
+    printf("PASSED constructor-distructore test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_set_element_exp() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on set\n");
+  } else {
+    printf("PASSED set test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_set_get_element_exp() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on set-get\n");
+  } else {
+    printf("PASSED set-get test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_del_element_exp() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on del\n");
+  } else {
+    printf("PASSED del test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_pop_next() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on pop_next\n");
+  } else {
+    printf("PASSED pop_next test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_next_at() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on next_at\n");
+  } else {
+    printf("PASSED next_at test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_reschedule_in_place() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on reschedule in place\n");
+  } else {
+    printf("PASSED reschedule in place test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_update_element_exp() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on update\n");
+  } else {
+    printf("PASSED update test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_node_keys() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on node keys\n");
+  } else {
+    printf("PASSED node keys test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_no_stale_entries() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on no stale entries\n");
+  } else {
+    printf("PASSED no stale entries test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_pop_order() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on pop order\n");
+  } else {
+    printf("PASSED pop order test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_mixed_updates_order() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on mixed updates order\n");
+  } else {
+    printf("PASSED mixed updates order test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_deadline_heap_chunks() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on deadline heap chunks\n");
+  } else {
+    printf("PASSED deadline heap chunks test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_offer_before_popped() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on offer before popped\n");
+  } else {
+    printf("PASSED offer before popped test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_set_element_exp_batch() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on set batch\n");
+  } else {
+    printf("PASSED set batch test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_pop_due() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on pop due\n");
+  } else {
+    printf("PASSED pop due test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_rename_element_exp() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on rename\n");
+  } else {
+    printf("PASSED rename test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_claim_due() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on claim due\n");
+  } else {
+    printf("PASSED claim due test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_set_element_exp_precision() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on precision\n");
+  } else {
+    printf("PASSED precision test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_bucket_heap() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on bucket heap\n");
+  } else {
+    printf("PASSED bucket heap test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_trie_nodes() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on trie nodes\n");
+  } else {
+    printf("PASSED trie nodes test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_backend_interface() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on backend interface\n");
+  } else {
+    printf("PASSED backend interface test\n");
+    ++(*num_of_passed_tests);
+  }
+
+  if (test_pop_wait() == FAIL) {
+    ++(*num_of_failed_tests);
+    printf("FAILED on pop_wait\n");
+  } else {
+    printf("PASSED pop_wait\n");
+    ++(*num_of_passed_tests);
+  }
+}
+
+#define MPSC_TEST_PRODUCERS 4
+#define MPSC_TEST_ITEMS 20000
+
+static void* _mpsc_produce(void* q) {
+  static int next_producer = 0;
+  long long producer = __sync_fetch_and_add(&next_producer, 1) % MPSC_TEST_PRODUCERS, i;
+  for (i = 0; i < MPSC_TEST_ITEMS; ++i) {
+    long long item = (producer << 32) | i;
+    while (mpsc_push(q, &item) != 0) sched_yield();
+  }
+  return NULL;
+}
+
+/*
+ * The queue holds up to its capacity, in order, and hands out every element pushed by concurrent
+ * producers exactly once, in the order each producer pushed them
+ */
+int test_mpsc_queue() {
+  int retval = SUCCESS;
+  mpsc_queue_t* q = mpsc_new(6, sizeof(long long));
+  long long item, i;
+
+  for (i = 0; i < 8; ++i) mpsc_push(q, &i);
+  if (mpsc_capacity(q) != 8 || mpsc_count(q) != 8 || mpsc_push(q, &i) != -1) {
+    printf("ERROR: queue of %zu holds %zu\n", mpsc_capacity(q), mpsc_count(q));
+    retval = FAIL;
+  }
+  // around the ring a few times
+  for (i = 8; i < 40; ++i) {
+    if (mpsc_pop(q, &item) != 0 || item != i - 8 || mpsc_push(q, &i) != 0) {
+      printf("ERROR: popped %lld, expected %lld\n", item, i - 8);
+      retval = FAIL;
+    }
+  }
+  for (i = 32; i < 40; ++i) mpsc_pop(q, &item);
+  if (item != 39 || mpsc_count(q) != 0 || mpsc_pop(q, &item) != -1) {
+    printf("ERROR: queue not empty, last popped %lld\n", item);
+    retval = FAIL;
+  }
+  mpsc_free(q);
+
+  q = mpsc_new(1024, sizeof(long long));
+  pthread_t producers[MPSC_TEST_PRODUCERS];
+  long long next[MPSC_TEST_PRODUCERS] = {0};
+  for (i = 0; i < MPSC_TEST_PRODUCERS; ++i) pthread_create(&producers[i], NULL, _mpsc_produce, q);
+  for (i = 0; i < MPSC_TEST_PRODUCERS * MPSC_TEST_ITEMS;) {
+    if (mpsc_pop(q, &item) != 0) continue;
+    long long producer = item >> 32;
+    // keep popping after an error, so the producers are not left waiting on a full queue
+    if (producer < MPSC_TEST_PRODUCERS && (item & 0xffffffff) != next[producer]++ &&
+        retval == SUCCESS) {
+      printf("ERROR: popped item %lld of producer %lld\n", item & 0xffffffff, producer);
+      retval = FAIL;
+    }
+    ++i;
+  }
+  for (i = 0; i < MPSC_TEST_PRODUCERS; ++i) pthread_join(producers[i], NULL);
+  mpsc_free(q);
+  return retval;
+}
+
+/*
+ * Peeking at the radix heap leaves its last deadline alone, so nodes offered ahead of the peeked
+ * minimum go in without re-bucketing the heap, and still come out first
+ */
+int test_radix_peek() {
+  int retval = SUCCESS;
+  radix_heap_t* r = radix_new();
+  radix_node_t nodes[4];
+  long long deadlines[] = {2000, 1000, 500, 700};
+  long long expected[] = {500, 700, 1000, 2000};
+  int i;
+
+  radix_offer(r, &nodes[0], deadlines[0]);
+  radix_offer(r, &nodes[1], deadlines[1]);
+  if (radix_peek(r) != &nodes[1] || r->last != 0) {
+    printf("ERROR: peek moved the last deadline to %lld\n", r->last);
+    retval = FAIL;
+  }
+  radix_offer(r, &nodes[2], deadlines[2]);
+  radix_offer(r, &nodes[3], deadlines[3]);
+  if (radix_peek(r) != &nodes[2] || r->last != 0) {
+    printf("ERROR: peeked %lld after offering earlier nodes\n", radix_peek(r)->deadline);
+    retval = FAIL;
+  }
+  // removing the peeked minimum is seen by the next peek
+  radix_remove(r, &nodes[2]);
+  if (radix_peek(r) != &nodes[3]) {
+    printf("ERROR: peeked %lld after removing the minimum\n", radix_peek(r)->deadline);
+    retval = FAIL;
+  }
+  radix_offer(r, &nodes[2], deadlines[2]);
+
+  for (i = 0; i < 4; ++i) {
+    radix_node_t* n = radix_poll(r);
+    if (n == NULL || n->deadline != expected[i] || r->last != expected[i]) {
+      printf("ERROR: expected %lld but polled %lld\n", expected[i], n ? n->deadline : -1);
+      retval = FAIL;
+    }
+  }
+  if (radix_count(r) != 0 || radix_peek(r) != NULL) retval = FAIL;
+
+  radix_free(r);
+  return retval;
+}
+
+int main(int argc, char* argv[]) {
+  mstime_t start_time = current_time_ms();
+  int num_of_failed_tests = 0;
+  int num_of_passed_tests = 0;
+
+  // independent of the store's indexes
+  if (test_deadline_timer() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on deadline timer\n");
+  } else {
+    printf("PASSED deadline timer test\n");
+    ++num_of_passed_tests;
+  }
+
+  if (test_timer_spin() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on timer spin\n");
+  } else {
+    printf("PASSED timer spin test\n");
+    ++num_of_passed_tests;
+  }
+
+  if (test_timer_scheduling() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on timer scheduling\n");
+  } else {
+    printf("PASSED timer scheduling test\n");
+    ++num_of_passed_tests;
+  }
+
+  if (test_periodic_timer() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on periodic timer\n");
+  } else {
+    printf("PASSED periodic timer test\n");
+    ++num_of_passed_tests;
+  }
+
+  if (test_mpsc_queue() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on mpsc queue\n");
+  } else {
+    printf("PASSED mpsc queue test\n");
+    ++num_of_passed_tests;
+  }
+
+  if (test_radix_peek() == FAIL) {
+    ++num_of_failed_tests;
+    printf("FAILED on radix peek\n");
+  } else {
+    printf("PASSED radix peek test\n");
+    ++num_of_passed_tests;
+  }
+  printf("\n");
+
+  for (test_keys = 0; test_keys < RTXS_KEYS_COUNT; ++test_keys) {
+    for (test_backend = 0; test_backend < RTXS_BACKEND_COUNT; ++test_backend) {
+      printf("%s backend, %s key index:\n", RTXDeadlineIndex_Type(test_backend)->name,
+             RTXKeyIndex_Type(test_keys)->name);
+      run_suite(&num_of_failed_tests, &num_of_passed_tests);
+      printf("\n");
+    }
   }
 
   double total_time_ms = current_time_ms() - start_time;
@@ -1,468 +1,587 @@
 #include "triemap.h"
 #include <math.h>
+#include <stddef.h>
 #include <sys/param.h>
 
-void *TRIEMAP_NOTFOUND = "NOT FOUND";
-
-void TrieMapNode_Free(TrieMapNode *n, void (*freeCB)(void *));
-
-/* Get a pointer to the children array of a node. This is not an actual member
- * of the node for
- * memory saving reasons */
-#define __trieMapNode_children(n) \
-  ((TrieMapNode **)((void *)n + sizeof(TrieMapNode) + (n->len + 1) + n->numChildren))
-
-#define __trieMapNode_childKey(n, c) (char *)((char *)n + sizeof(TrieMapNode) + n->len + 1 + c)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define __trieMapNode_isTerminal(n) (n->flags & TM_NODE_TERMINAL)
-
-#define __trieMapNode_isDeleted(n) (n->flags & TM_NODE_DELETED)
+void *TRIEMAP_NOTFOUND = "NOT FOUND";
 
-/* The byte size of a node, based on its internal string length and number of
- * children */
-tm_len_t __trieMapNode_Sizeof(tm_len_t numChildren, tm_len_t slen) {
-  return (sizeof(TrieMapNode) + numChildren * sizeof(TrieMapNode *) + (slen + 1) + numChildren);
+typedef struct {
+  TrieMapNode n;
+  uint8_t keys[4];
+  void *children[4];
+  char str[];
+} TrieMapNode4;
+
+typedef struct {
+  TrieMapNode n;
+  uint8_t keys[16];
+  void *children[16];
+  char str[];
+} TrieMapNode16;
+
+typedef struct {
+  TrieMapNode n;
+  // the slot + 1 of each byte's child in children[], 0 if there is none
+  uint8_t index[256];
+  void *children[48];
+  char str[];
+} TrieMapNode48;
+
+typedef struct {
+  TrieMapNode n;
+  void *children[256];
+  char str[];
+} TrieMapNode256;
+
+/* child pointers to leaves are tagged in their lowest bit */
+#define __isLeaf(p) ((uintptr_t)(p)&1)
+#define __leaf(p) ((TrieMapLeaf *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define __tagLeaf(l) ((void *)((uintptr_t)(l) | 1))
+
+/* shrink a node once it has this many children or less, below the next smaller node's capacity
+ * so a node does not flip between two types when a child is added and removed again */
+#define TM_NODE16_SHRINK 3
+#define TM_NODE48_SHRINK 12
+#define TM_NODE256_SHRINK 37
+
+static const size_t __nodeSizes[] = {offsetof(TrieMapNode4, str), offsetof(TrieMapNode16, str),
+                                     offsetof(TrieMapNode48, str), offsetof(TrieMapNode256, str)};
+
+/* Get a pointer to the compressed prefix of a node, allocated after its children */
+#define __trieMapNode_str(n) ((char *)(n) + __nodeSizes[(n)->type])
+
+/* The byte size of a node, based on its type and prefix length */
+static size_t __trieMapNode_Sizeof(uint8_t type, tm_len_t len) {
+  return __nodeSizes[type] + len;
 }
 
-TrieMapNode *__trieMapNode_resizeChildren(TrieMapNode *n, int offset) {
-  n = realloc(n, __trieMapNode_Sizeof(n->numChildren + offset, n->len));
-  TrieMapNode **children = __trieMapNode_children(n);
-
-  // stretch or shrink the child key cache array
-  memmove(((char *)children) + offset, (char *)children, sizeof(TrieMapNode *) * n->numChildren);
-  n->numChildren += offset;
-  return n;
+static TrieMapLeaf *__newTrieMapLeaf(const char *str, tm_len_t len, void *value) {
+  TrieMapLeaf *l = malloc(sizeof(TrieMapLeaf) + len);
+  l->value = value;
+  l->len = len;
+  memcpy(l->str, str, len);
+  return l;
 }
 
-/* Create a new trie node. str is a string to be copied into the node,
- * starting from offset up until len. numChildren is the initial number of
- * allocated child nodes */
-TrieMapNode *__newTrieMapNode(char *str, tm_len_t offset, tm_len_t len, tm_len_t numChildren,
-                              void *value, int terminal) {
-  tm_len_t nlen = len - offset;
-  TrieMapNode *n = malloc(__trieMapNode_Sizeof(numChildren, nlen));
-  n->len = nlen;
-  n->numChildren = numChildren;
-  n->value = value;
-  n->flags = terminal ? TM_NODE_TERMINAL : 0;
+static int __trieMapLeaf_matches(const TrieMapLeaf *l, const char *str, tm_len_t len) {
+  return l->len == len && memcmp(l->str, str, len) == 0;
+}
 
-  memcpy(n->str, str + offset, nlen);
+static void __trieMapLeaf_Free(TrieMapLeaf *l, void (*freeCB)(void *)) {
+  if (l->value) {
+    if (freeCB) {
+      freeCB(l->value);
+    } else {
+      free(l->value);
+    }
+  }
+  free(l);
+}
 
+/* Create a new empty inner node of the given type, with a copy of str as its prefix */
+static TrieMapNode *__newTrieMapNode(uint8_t type, const char *str, tm_len_t len) {
+  TrieMapNode *n = calloc(1, __trieMapNode_Sizeof(type, len));
+  n->type = type;
+  n->len = len;
+  memcpy(__trieMapNode_str(n), str, len);
   return n;
 }
 
 TrieMap *NewTrieMap() {
   TrieMap *tm = malloc(sizeof(TrieMap));
   tm->cardinality = 0;
-  tm->root = __newTrieMapNode((char *)"", 0, 0, 0, NULL, 0);
+  tm->root = NULL;
   return tm;
 }
 
-TrieMapNode *__trieMapNode_AddChild(TrieMapNode *n, char *str, tm_len_t offset, tm_len_t len,
-                                    void *value) {
-  // make room for another child
-  n = __trieMapNode_resizeChildren(n, 1);
+/* Find the child slot of a node for a given byte. NULL if there is no such child */
+static void **__trieMapNode_findChild(TrieMapNode *n, uint8_t c) {
+  switch (n->type) {
+    case TM_NODE4: {
+      TrieMapNode4 *n4 = (TrieMapNode4 *)n;
+      for (int i = 0; i < n->numChildren; i++) {
+        if (n4->keys[i] == c) return &n4->children[i];
+      }
+      return NULL;
+    }
+    case TM_NODE16: {
+      TrieMapNode16 *n16 = (TrieMapNode16 *)n;
+#ifdef __SSE2__
+      __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i *)n16->keys));
+      int mask = _mm_movemask_epi8(cmp) & ((1 << n->numChildren) - 1);
+      return mask ? &n16->children[__builtin_ctz(mask)] : NULL;
+#else
+      for (int i = 0; i < n->numChildren; i++) {
+        if (n16->keys[i] == c) return &n16->children[i];
+      }
+      return NULL;
+#endif
+    }
+    case TM_NODE48: {
+      TrieMapNode48 *n48 = (TrieMapNode48 *)n;
+      return n48->index[c] ? &n48->children[n48->index[c] - 1] : NULL;
+    }
+    default: {
+      TrieMapNode256 *n256 = (TrieMapNode256 *)n;
+      return n256->children[c] ? &n256->children[c] : NULL;
+    }
+  }
+}
+
+/* Get the child at or after a position of a node, in byte order. Positions are indexes into the
+ * keys of Node4 and Node16, and bytes for the larger nodes. Advances *pos past the child.
+ * Returns NULL when there are no more children */
+static void *__trieMapNode_nextChild(TrieMapNode *n, int *pos) {
+  switch (n->type) {
+    case TM_NODE4:
+      return *pos < n->numChildren ? ((TrieMapNode4 *)n)->children[(*pos)++] : NULL;
+    case TM_NODE16:
+      return *pos < n->numChildren ? ((TrieMapNode16 *)n)->children[(*pos)++] : NULL;
+    case TM_NODE48: {
+      TrieMapNode48 *n48 = (TrieMapNode48 *)n;
+      for (; *pos < 256; (*pos)++) {
+        if (n48->index[*pos]) return n48->children[n48->index[(*pos)++] - 1];
+      }
+      return NULL;
+    }
+    default: {
+      TrieMapNode256 *n256 = (TrieMapNode256 *)n;
+      for (; *pos < 256; (*pos)++) {
+        if (n256->children[*pos]) return n256->children[(*pos)++];
+      }
+      return NULL;
+    }
+  }
+}
 
-  // a newly added child must be a terminal node
-  TrieMapNode *child = __newTrieMapNode(str, offset, len, 0, value, 1);
-  *__trieMapNode_childKey(n, n->numChildren - 1) = str[offset];
+/* Copy a node into a new node of another type, keeping its prefix, leaf and children, and free
+ * the old one */
+static TrieMapNode *__trieMapNode_resize(TrieMapNode *n, uint8_t type) {
+  TrieMapNode *nn = __newTrieMapNode(type, __trieMapNode_str(n), n->len);
+  nn->leaf = n->leaf;
+  nn->numChildren = n->numChildren;
+
+  int pos = 0, i = 0;
+  void *child;
+  switch (type) {
+    case TM_NODE4:
+    case TM_NODE16: {
+      // both keep their keys at the same offset, so it does not matter which one we fill
+      TrieMapNode16 *n16 = (TrieMapNode16 *)nn;
+      uint8_t *keys = type == TM_NODE4 ? ((TrieMapNode4 *)nn)->keys : n16->keys;
+      void **children = type == TM_NODE4 ? ((TrieMapNode4 *)nn)->children : n16->children;
+      if (n->type == TM_NODE4 || n->type == TM_NODE16) {
+        uint8_t *okeys = n->type == TM_NODE4 ? ((TrieMapNode4 *)n)->keys : ((TrieMapNode16 *)n)->keys;
+        void **ochildren =
+            n->type == TM_NODE4 ? ((TrieMapNode4 *)n)->children : ((TrieMapNode16 *)n)->children;
+        memcpy(keys, okeys, n->numChildren);
+        memcpy(children, ochildren, n->numChildren * sizeof(void *));
+      } else {
+        while ((child = __trieMapNode_nextChild(n, &pos))) {
+          keys[i] = pos - 1;
+          children[i++] = child;
+        }
+      }
+      break;
+    }
+    case TM_NODE48: {
+      TrieMapNode48 *n48 = (TrieMapNode48 *)nn;
+      while ((child = __trieMapNode_nextChild(n, &pos))) {
+        uint8_t c = (n->type == TM_NODE16) ? ((TrieMapNode16 *)n)->keys[pos - 1] : pos - 1;
+        n48->children[i] = child;
+        n48->index[c] = ++i;
+      }
+      break;
+    }
+    default: {
+      TrieMapNode256 *n256 = (TrieMapNode256 *)nn;
+      while ((child = __trieMapNode_nextChild(n, &pos))) {
+        n256->children[pos - 1] = child;
+      }
+    }
+  }
 
-  __trieMapNode_children(n)[n->numChildren - 1] = child;
-  n->flags &= ~TM_NODE_SORTED;
-  return n;
+  free(n);
+  return nn;
 }
 
-TrieMapNode *__trieMapNode_Split(TrieMapNode *n, tm_len_t offset) {
-  // Copy the current node's data and children to a new child node
-  TrieMapNode *newChild = __newTrieMapNode(n->str, offset, n->len, n->numChildren, n->value,
-                                           __trieMapNode_isTerminal(n));
-  newChild->flags = n->flags;
-
-  TrieMapNode **children = __trieMapNode_children(n);
-  TrieMapNode **newChildren = __trieMapNode_children(newChild);
-  memcpy(newChildren, children, sizeof(TrieMapNode *) * n->numChildren);
-  memcpy(__trieMapNode_childKey(newChild, 0), __trieMapNode_childKey(n, 0), n->numChildren);
-  // reduce the node to be just one child long with no score
-  n->numChildren = 1;
-  n->len = offset;
-  n->value = NULL;
-  // the parent node is now non terminal and non sorted
-  n->flags = 0;  //&= ~(TM_NODE_TERMINAL | TM_NODE_DELETED | TM_NODE_SORTED);
-
-  n = realloc(n, __trieMapNode_Sizeof(n->numChildren, n->len));
-  __trieMapNode_children(n)[0] = newChild;
-  *__trieMapNode_childKey(n, 0) = newChild->str[0];
-  return n;
+/* Insert a byte into the sorted keys of a Node4 or Node16, returning its slot */
+static int __sortedInsert(uint8_t *keys, void **children, int num, uint8_t c) {
+  int i = num;
+  while (i > 0 && keys[i - 1] > c) {
+    keys[i] = keys[i - 1];
+    children[i] = children[i - 1];
+    i--;
+  }
+  keys[i] = c;
+  return i;
 }
 
-int TrieMapNode_Add(TrieMapNode **np, char *str, tm_len_t len, void *value, TrieMapReplaceFunc cb) {
+/* Add a child to the node at *np, growing the node into a larger type if it is full */
+static void __trieMapNode_addChild(TrieMapNode **np, uint8_t c, void *child) {
   TrieMapNode *n = *np;
+  switch (n->type) {
+    case TM_NODE4: {
+      if (n->numChildren == 4) break;
+      TrieMapNode4 *n4 = (TrieMapNode4 *)n;
+      n4->children[__sortedInsert(n4->keys, n4->children, n->numChildren, c)] = child;
+      n->numChildren++;
+      return;
+    }
+    case TM_NODE16: {
+      if (n->numChildren == 16) break;
+      TrieMapNode16 *n16 = (TrieMapNode16 *)n;
+      n16->children[__sortedInsert(n16->keys, n16->children, n->numChildren, c)] = child;
+      n->numChildren++;
+      return;
+    }
+    case TM_NODE48: {
+      if (n->numChildren == 48) break;
+      TrieMapNode48 *n48 = (TrieMapNode48 *)n;
+      int i = 0;
+      while (n48->children[i]) i++;
+      n48->children[i] = child;
+      n48->index[c] = i + 1;
+      n->numChildren++;
+      return;
+    }
+    default:
+      ((TrieMapNode256 *)n)->children[c] = child;
+      n->numChildren++;
+      return;
+  }
+
+  // the node is full
+  *np = __trieMapNode_resize(n, n->type + 1);
+  __trieMapNode_addChild(np, c, child);
+}
 
-  tm_len_t offset = 0;
-  for (; offset < len && offset < n->len; offset++) {
-    if (str[offset] != n->str[offset]) {
+/* Remove the child of a byte from a node, without freeing it */
+static void __trieMapNode_removeChild(TrieMapNode *n, uint8_t c) {
+  switch (n->type) {
+    case TM_NODE4:
+    case TM_NODE16: {
+      uint8_t *keys = n->type == TM_NODE4 ? ((TrieMapNode4 *)n)->keys : ((TrieMapNode16 *)n)->keys;
+      void **children =
+          n->type == TM_NODE4 ? ((TrieMapNode4 *)n)->children : ((TrieMapNode16 *)n)->children;
+      int i = 0;
+      while (keys[i] != c) i++;
+      memmove(keys + i, keys + i + 1, n->numChildren - i - 1);
+      memmove(children + i, children + i + 1, (n->numChildren - i - 1) * sizeof(void *));
       break;
     }
+    case TM_NODE48: {
+      TrieMapNode48 *n48 = (TrieMapNode48 *)n;
+      n48->children[n48->index[c] - 1] = NULL;
+      n48->index[c] = 0;
+      break;
+    }
+    default:
+      ((TrieMapNode256 *)n)->children[c] = NULL;
   }
-  // we broke off before the end of the string
-  if (offset < n->len) {
-    // split the node and create 2 child nodes:
-    // 1. a child representing the new string from the diverted offset onwards
-    // 2. a child representing the old node's suffix from the diverted offset
-    // and the old children
-    n = __trieMapNode_Split(n, offset);
-
-    // the new string matches the split node exactly!
-    // we simply turn the split node, which is now non terminal, into a
-    // terminal node
-    if (offset == len) {
-      n->value = value;
-      n->flags |= TM_NODE_TERMINAL;
-    } else {
-      // we add a child
-      n = __trieMapNode_AddChild(n, str, offset, len, value);
+  n->numChildren--;
+}
+
+/* Shrink, collapse or remove the node at *np after a key below it was deleted:
+ *   1. A node with no children is replaced by its leaf, or removed if it has none
+ *   2. A node with no leaf and a single child is merged into the child
+ *   3. A node with few enough children is copied into a smaller node type
+ */
+static void __trieMapNode_optimize(void **np) {
+  TrieMapNode *n = *np;
+
+  if (n->numChildren == 0) {
+    *np = n->leaf ? __tagLeaf(n->leaf) : NULL;
+    free(n);
+    return;
+  }
+
+  if (n->numChildren == 1 && !n->leaf) {
+    int pos = 0;
+    void *child = __trieMapNode_nextChild(n, &pos);
+    if (!__isLeaf(child)) {
+      // the child's prefix becomes our prefix, the child's byte and its own prefix
+      TrieMapNode *ch = child;
+      uint8_t c = pos - 1;
+      if (n->type == TM_NODE4) {
+        c = ((TrieMapNode4 *)n)->keys[0];
+      } else if (n->type == TM_NODE16) {
+        c = ((TrieMapNode16 *)n)->keys[0];
+      }
+      tm_len_t len = n->len + 1 + ch->len;
+      ch = realloc(ch, __trieMapNode_Sizeof(ch->type, len));
+      char *str = __trieMapNode_str(ch);
+      memmove(str + n->len + 1, str, ch->len);
+      memcpy(str, __trieMapNode_str(n), n->len);
+      str[n->len] = c;
+      ch->len = len;
+      child = ch;
     }
-    *np = n;
+    // leaves keep their full key, they can simply move up
+    *np = child;
+    free(n);
+    return;
+  }
+
+  if ((n->type == TM_NODE16 && n->numChildren <= TM_NODE16_SHRINK) ||
+      (n->type == TM_NODE48 && n->numChildren <= TM_NODE48_SHRINK) ||
+      (n->type == TM_NODE256 && n->numChildren <= TM_NODE256_SHRINK)) {
+    *np = __trieMapNode_resize(n, n->type - 1);
+  }
+}
+
+/* Replace the value of an existing leaf, the way TrieMap_Add documents it */
+static void __trieMapLeaf_replace(TrieMapLeaf *l, void *value, TrieMapReplaceFunc cb) {
+  if (cb) {
+    l->value = cb(l->value, value);
+  } else {
+    if (l->value) {
+      free(l->value);
+    }
+    l->value = value;
+  }
+}
+
+static int TrieMapNode_Add(void **np, char *str, tm_len_t len, tm_len_t depth, void *value,
+                           TrieMapReplaceFunc cb) {
+  void *p = *np;
+
+  if (!p) {
+    *np = __tagLeaf(__newTrieMapLeaf(str, len, value));
     return 1;
   }
 
-  // we're inserting in an existing node - just replace the value
-  if (offset == len) {
-    int term = __trieMapNode_isTerminal(n);
-    int deleted = __trieMapNode_isDeleted(n);
+  if (__isLeaf(p)) {
+    TrieMapLeaf *l = __leaf(p);
+    if (__trieMapLeaf_matches(l, str, len)) {
+      __trieMapLeaf_replace(l, value, cb);
+      return 0;
+    }
 
-    if (cb) {
-      n->value = cb(n->value, value);
+    // split the leaf: a new node holding the common part of both keys as its prefix, with the
+    // old and the new leaf below it
+    tm_len_t common = 0;
+    while (depth + common < len && depth + common < l->len &&
+           str[depth + common] == l->str[depth + common]) {
+      common++;
+    }
+    TrieMapNode *n = __newTrieMapNode(TM_NODE4, str + depth, common);
+    depth += common;
+    TrieMapLeaf *nl = __newTrieMapLeaf(str, len, value);
+    if (l->len == depth) {
+      n->leaf = l;
     } else {
-      if (n->value) {
-        free(n->value);
-      }
-      n->value = value;
+      __trieMapNode_addChild(&n, l->str[depth], p);
+    }
+    if (len == depth) {
+      n->leaf = nl;
+    } else {
+      __trieMapNode_addChild(&n, str[depth], __tagLeaf(nl));
     }
-
-    // set the node as terminal
-    n->flags |= TM_NODE_TERMINAL;
-    // if it was deleted, make sure it's not now
-    n->flags &= ~TM_NODE_DELETED;
-    n->flags &= ~TM_NODE_SORTED;
     *np = n;
-    // if the node existed - we return 0, otherwise return 1 as it's a new
-    // node
-    return (term && !deleted) ? 0 : 1;
+    return 1;
   }
 
-  // proceed to the next child or add a new child for the current char
-  for (tm_len_t i = 0; i < n->numChildren; i++) {
-    TrieMapNode *child = __trieMapNode_children(n)[i];
+  TrieMapNode *n = p;
+  if (n->len) {
+    char *nstr = __trieMapNode_str(n);
+    tm_len_t offset = 0;
+    while (offset < n->len && depth + offset < len && str[depth + offset] == nstr[offset]) {
+      offset++;
+    }
 
-    if (str[offset] == child->str[0]) {
-      int rc = TrieMapNode_Add(&child, str + offset, len - offset, value, cb);
-      __trieMapNode_children(n)[i] = child;
-      //      *__trieMapNode_childKey(n, i) = child->str[0];
+    // we broke off before the end of the prefix
+    if (offset < n->len) {
+      // split the prefix: a new node holding the matching part, with the old node (holding the
+      // rest of its prefix) and the new leaf below it
+      TrieMapNode *parent = __newTrieMapNode(TM_NODE4, nstr, offset);
+      uint8_t c = nstr[offset];
+      n->len -= offset + 1;
+      memmove(nstr, nstr + offset + 1, n->len);
+      __trieMapNode_addChild(&parent, c, n);
+
+      TrieMapLeaf *nl = __newTrieMapLeaf(str, len, value);
+      if (depth + offset == len) {
+        parent->leaf = nl;
+      } else {
+        __trieMapNode_addChild(&parent, str[depth + offset], __tagLeaf(nl));
+      }
+      *np = parent;
+      return 1;
+    }
+    depth += n->len;
+  }
 
-      return rc;
+  // the key ends at this node
+  if (depth == len) {
+    if (n->leaf) {
+      __trieMapLeaf_replace(n->leaf, value, cb);
+      return 0;
     }
+    n->leaf = __newTrieMapLeaf(str, len, value);
+    return 1;
   }
 
-  *np = __trieMapNode_AddChild(n, str, offset, len, value);
+  // proceed to the next child or add a new child for the current char
+  void **child = __trieMapNode_findChild(n, str[depth]);
+  if (child) {
+    return TrieMapNode_Add(child, str, len, depth + 1, value, cb);
+  }
+
+  __trieMapNode_addChild((TrieMapNode **)np, str[depth],
+                         __tagLeaf(__newTrieMapLeaf(str, len, value)));
   return 1;
 }
 
 int TrieMap_Add(TrieMap *t, char *str, tm_len_t len, void *value, TrieMapReplaceFunc cb) {
-  int rc = TrieMapNode_Add(&t->root, str, len, value, cb);
+  int rc = TrieMapNode_Add(&t->root, str, len, 0, value, cb);
   t->cardinality += rc;
   return rc;
 }
 
-// comparator for node sorting by child max score
-static int __cmp_nodes(const void *p1, const void *p2) {
-  return (*(TrieMapNode **)p1)->str[0] - (*(TrieMapNode **)p2)->str[0];
-}
-
-static int __cmp_chars(const void *p1, const void *p2) {
-  return *(char *)p1 - *(char *)p2;
-}
-
-/* Sort the children of a node by their first letter to allow binary search */
-static inline void __trieNode_sortChildren(TrieMapNode *n) {
-  if ((0 == (n->flags & TM_NODE_SORTED)) && n->numChildren > 3) {
-    qsort(__trieMapNode_children(n), n->numChildren, sizeof(TrieMapNode *), __cmp_nodes);
-    qsort(__trieMapNode_childKey(n, 0), n->numChildren, 1, __cmp_chars);
-    n->flags |= TM_NODE_SORTED;
-  }
-}
+void *TrieMap_Find(TrieMap *t, char *str, tm_len_t len) {
+  void *p = t->root;
+  tm_len_t depth = 0;
 
-void *TrieMapNode_Find(TrieMapNode *n, char *str, tm_len_t len) {
-  tm_len_t offset = 0;
-  while (n && (offset < len || len == 0)) {
-    tm_len_t localOffset = 0;
-    tm_len_t nlen = n->len;
-    while (offset < len && localOffset < nlen) {
-      if (str[offset] != n->str[localOffset]) {
-        break;
-      }
-      offset++;
-      localOffset++;
-    }
-
-    // we've reached the end of the node's string
-    if (localOffset == nlen) {
-      // we're at the end of both strings!
-      if (offset == len) {
-        // If this is a terminal, non deleted node - return its value
-        if (__trieMapNode_isTerminal(n) && !__trieMapNode_isDeleted(n)) {
-          return n->value;
-        } else {  // this node is either non terminal or deleted - return not found
-          return TRIEMAP_NOTFOUND;
-        }
-      }
-      // we've reached the end of the node's string but not the search string
-      // let's find a child to continue to
-      tm_len_t i = 0;
-      TrieMapNode *nextChild = NULL;
-
-      char *childKeys = __trieMapNode_childKey(n, 0);
-      char c = str[offset];
-      if (n->flags & TM_NODE_SORTED) {
-        int bottom = 0, top = n->numChildren - 1;
-
-        while (bottom <= top) {
-          int mid = (bottom + top) / 2;
-
-          char cc = *__trieMapNode_childKey(n, mid);
-          if (c < cc) {
-            top = mid - 1;
-          } else if (c > cc) {
-            bottom = mid + 1;
-          } else {
-            nextChild = __trieMapNode_children(n)[mid];
-            break;
-          }
-        }
+  while (p) {
+    if (__isLeaf(p)) {
+      TrieMapLeaf *l = __leaf(p);
+      return __trieMapLeaf_matches(l, str, len) ? l->value : TRIEMAP_NOTFOUND;
+    }
 
-      } else {
-        while (i < n->numChildren) {
-          if (str[offset] == childKeys[i]) {
-            nextChild = __trieMapNode_children(n)[i];
-            break;
-          }
-          ++i;
-        }
+    TrieMapNode *n = p;
+    if (n->len) {
+      if (len - depth < n->len || memcmp(str + depth, __trieMapNode_str(n), n->len)) {
+        return TRIEMAP_NOTFOUND;
       }
+      depth += n->len;
+    }
 
-      // we couldn't find a matching child
-      n = nextChild;
-    } else {
-      return TRIEMAP_NOTFOUND;
+    // we're at the end of the string
+    if (depth == len) {
+      return n->leaf ? n->leaf->value : TRIEMAP_NOTFOUND;
     }
+
+    void **child = __trieMapNode_findChild(n, str[depth++]);
+    p = child ? *child : NULL;
   }
 
   return TRIEMAP_NOTFOUND;
 }
 
-/* Find a node by string. Return the node matching the string even if it is not
- * terminal. Puts the node local offset in *offset */
-TrieMapNode *TrieMapNode_FindNode(TrieMapNode *n, char *str, tm_len_t len, tm_len_t *poffset) {
-  tm_len_t offset = 0;
-  while (n && (offset < len || len == 0)) {
-    tm_len_t localOffset = 0;
-    tm_len_t nlen = n->len;
-    while (offset < len && localOffset < nlen) {
-      if (str[offset] != n->str[localOffset]) {
-        break;
-      }
-      offset++;
-      localOffset++;
-    }
+/* Find the subtree holding all the keys starting with a prefix. NULL if there are none */
+static void *TrieMapNode_FindPrefix(void *p, const char *str, tm_len_t len) {
+  tm_len_t depth = 0;
 
-    // we've reached the end of the string - return the node even if it's not
-    // temrinal
-    if (offset == len) {
-      // let the caller know the local offset
-      if (poffset) {
-        *poffset = localOffset;
-      }
-      return n;
+  while (p && depth < len) {
+    if (__isLeaf(p)) {
+      TrieMapLeaf *l = __leaf(p);
+      return (l->len >= len && memcmp(l->str, str, len) == 0) ? p : NULL;
     }
 
-    // we've reached the end of the node's string
-    if (localOffset == nlen) {
-      // we've reached the end of the node's string but not the search string
-      // let's find a child to continue to
-      tm_len_t i = 0;
-      TrieMapNode *nextChild = NULL;
-
-      char *childKeys = __trieMapNode_childKey(n, 0);
-      char c = str[offset];
-
-      while (i < n->numChildren) {
-        if (str[offset] == childKeys[i]) {
-          nextChild = __trieMapNode_children(n)[i];
-          break;
-        }
-        ++i;
-      }
-
-      // we couldn't find a matching child
-      n = nextChild;
-    } else {
+    TrieMapNode *n = p;
+    tm_len_t cmplen = MIN(n->len, len - depth);
+    if (memcmp(str + depth, __trieMapNode_str(n), cmplen)) {
       return NULL;
     }
+    depth += cmplen;
+    if (depth == len) {
+      break;
+    }
+
+    void **child = __trieMapNode_findChild(n, str[depth++]);
+    p = child ? *child : NULL;
   }
 
-  return NULL;
+  return p;
 }
 
-void *TrieMap_Find(TrieMap *t, char *str, tm_len_t len) {
-  return TrieMapNode_Find(t->root, str, len);
-}
+static int TrieMapNode_Delete(void **np, char *str, tm_len_t len, tm_len_t depth,
+                              void (*freeCB)(void *)) {
+  void *p = *np;
 
-/* If a node has a single child after delete, we can merged them. This
- * deletes
- * the node and returns a newly allocated node */
-TrieMapNode *__trieMapNode_MergeWithSingleChild(TrieMapNode *n) {
-  // we do not merge terminal nodes
-  if (__trieMapNode_isTerminal(n) || n->numChildren != 1) {
-    return n;
+  if (!p) {
+    return 0;
   }
 
-  TrieMapNode *ch = *__trieMapNode_children(n);
-
-  // Copy the current node's data and children to a new child node
-  char nstr[n->len + ch->len + 1];
-  memcpy(nstr, n->str, sizeof(char) * n->len);
-  memcpy(&nstr[n->len], ch->str, sizeof(char) * ch->len);
-  TrieMapNode *merged = __newTrieMapNode(nstr, 0, n->len + ch->len, ch->numChildren, ch->value,
-                                         __trieMapNode_isTerminal(ch));
-
-  merged->numChildren = ch->numChildren;
-  merged->flags = ch->flags;
-
-  memcpy(__trieMapNode_children(merged), __trieMapNode_children(ch),
-         sizeof(TrieMapNode *) * merged->numChildren);
-  memcpy(__trieMapNode_childKey(merged, 0), __trieMapNode_childKey(ch, 0), merged->numChildren);
-  free(n);
-  free(ch);
-
-  return merged;
-}
-
-/* Optimize the node and its children:
- *   1. If a child should be deleted - delete it and reduce the child count
- *   2. If a child has a single child - merge them
- */
-void __trieMapNode_optimizeChildren(TrieMapNode *n, void (*freeCB)(void *)) {
-  int i = 0;
-  TrieMapNode **nodes = __trieMapNode_children(n);
-  // free deleted terminal nodes
-  while (i < n->numChildren) {
-    // if this is a deleted node with no children - remove it
-    if (nodes[i]->numChildren == 0 && __trieMapNode_isDeleted(nodes[i])) {
-      TrieMapNode_Free(nodes[i], freeCB);
-
-      nodes[i] = NULL;
-      char *nk = __trieMapNode_childKey(n, i);
-      // just "fill" the hole with the next node up
-      while (i < n->numChildren - 1) {
-        nodes[i] = nodes[i + 1];
-        *nk = *(nk + 1);
-        i++;
-        nk++;
-      }
-      // reduce child count
-
-      n->numChildren--;
-      memmove(((char *)nodes) - 1, (char *)nodes, sizeof(TrieMapNode *) * n->numChildren);
+  // a single key in the whole trie
+  if (__isLeaf(p)) {
+    if (!__trieMapLeaf_matches(__leaf(p), str, len)) {
+      return 0;
+    }
+    __trieMapLeaf_Free(__leaf(p), freeCB);
+    *np = NULL;
+    return 1;
+  }
 
-    } else {
-      // this node is ok!
-      // if needed - merge this node with it its single child
-      if (nodes[i] && nodes[i]->numChildren == 1) {
-        nodes[i] = __trieMapNode_MergeWithSingleChild(nodes[i]);
-      }
+  TrieMapNode *n = p;
+  if (n->len) {
+    if (len - depth < n->len || memcmp(str + depth, __trieMapNode_str(n), n->len)) {
+      return 0;
     }
-    i++;
+    depth += n->len;
   }
-}
 
-int TrieMapNode_Delete(TrieMapNode *n, char *str, tm_len_t len, void (*freeCB)(void *)) {
-  tm_len_t offset = 0;
-  int stackCap = 8;
-  TrieMapNode **stack = calloc(stackCap, sizeof(TrieMapNode *));
-  int stackPos = 0;
-  int rc = 0;
-  while (n && (offset < len || len == 0)) {
-    stack[stackPos++] = n;
-    if (stackPos == stackCap) {
-      stackCap *= 2;
-      stack = realloc(stack, stackCap * sizeof(TrieMapNode *));
-    }
-    tm_len_t localOffset = 0;
-    for (; offset < len && localOffset < n->len; offset++, localOffset++) {
-      if (str[offset] != n->str[localOffset]) {
-        break;
-      }
+  if (depth == len) {
+    if (!n->leaf) {
+      return 0;
+    }
+    __trieMapLeaf_Free(n->leaf, freeCB);
+    n->leaf = NULL;
+  } else {
+    uint8_t c = str[depth];
+    void **child = __trieMapNode_findChild(n, c);
+    if (!child) {
+      return 0;
     }
 
-    if (offset == len) {
-      // we're at the end of both strings!
-      // this means we've found what we're looking for
-      if (localOffset == n->len) {
-        if (!(n->flags & TM_NODE_DELETED)) {
-          n->flags |= TM_NODE_DELETED;
-          n->flags &= ~TM_NODE_TERMINAL;
-
-          if (n->value) {
-            if (freeCB) {
-              freeCB(n->value);
-            } else {
-              free(n->value);
-            }
-            n->value = NULL;
-          }
-
-          rc = 1;
-        }
-        goto end;
-      }
-    } else if (localOffset == n->len) {
-      // we've reached the end of the node's string but not the search string
-      // let's find a child to continue to
-      tm_len_t i = 0;
-      TrieMapNode *nextChild = NULL;
-      for (; i < n->numChildren; i++) {
-        if (str[offset] == *__trieMapNode_childKey(n, i)) {
-          nextChild = __trieMapNode_children(n)[i];
-          break;
-        }
+    if (__isLeaf(*child)) {
+      if (!__trieMapLeaf_matches(__leaf(*child), str, len)) {
+        return 0;
       }
-
-      // we couldn't find a matching child
-      n = nextChild;
+      __trieMapLeaf_Free(__leaf(*child), freeCB);
+      __trieMapNode_removeChild(n, c);
     } else {
-      goto end;
+      if (!TrieMapNode_Delete(child, str, len, depth + 1, freeCB)) {
+        return 0;
+      }
+      // the child could have been left empty and removed
+      if (*child == NULL) {
+        __trieMapNode_removeChild(n, c);
+      }
     }
   }
 
-end:
-
-  while (stackPos--) {
-    __trieMapNode_optimizeChildren(stack[stackPos], freeCB);
-  }
-  free(stack);
-  return rc;
+  __trieMapNode_optimize(np);
+  return 1;
 }
 
 int TrieMap_Delete(TrieMap *t, char *str, tm_len_t len, void (*freeCB)(void *)) {
-  int rc = TrieMapNode_Delete(t->root, str, len, freeCB);
+  int rc = TrieMapNode_Delete(&t->root, str, len, 0, freeCB);
   t->cardinality -= rc;
   return rc;
 }
 
-size_t TrieMapNode_MemUsage(TrieMapNode *n) {
-  size_t ret = __trieMapNode_Sizeof(n->numChildren, n->len);
-  for (tm_len_t i = 0; i < n->numChildren; i++) {
-    TrieMapNode *child = __trieMapNode_children(n)[i];
+static size_t TrieMapNode_MemUsage(void *p) {
+  if (!p) {
+    return 0;
+  }
+  if (__isLeaf(p)) {
+    return sizeof(TrieMapLeaf) + __leaf(p)->len;
+  }
+
+  TrieMapNode *n = p;
+  size_t ret = __trieMapNode_Sizeof(n->type, n->len);
+  if (n->leaf) {
+    ret += sizeof(TrieMapLeaf) + n->leaf->len;
+  }
+  int pos = 0;
+  void *child;
+  while ((child = __trieMapNode_nextChild(n, &pos))) {
     ret += TrieMapNode_MemUsage(child);
   }
   return ret;
@@ -472,233 +591,146 @@ size_t TrieMap_MemUsage(TrieMap *t) {
   return TrieMapNode_MemUsage(t->root);
 }
 
-void TrieMapNode_Free(TrieMapNode *n, void (*freeCB)(void *)) {
-  for (tm_len_t i = 0; i < n->numChildren; i++) {
-    TrieMapNode *child = __trieMapNode_children(n)[i];
-    TrieMapNode_Free(child, freeCB);
+static void TrieMapNode_Free(void *p, void (*freeCB)(void *)) {
+  if (!p) {
+    return;
   }
-  if (n->value) {
-    if (freeCB) {
-      freeCB(n->value);
-    } else {
-      free(n->value);
-    }
+  if (__isLeaf(p)) {
+    __trieMapLeaf_Free(__leaf(p), freeCB);
+    return;
   }
 
+  TrieMapNode *n = p;
+  int pos = 0;
+  void *child;
+  while ((child = __trieMapNode_nextChild(n, &pos))) {
+    TrieMapNode_Free(child, freeCB);
+  }
+  if (n->leaf) {
+    __trieMapLeaf_Free(n->leaf, freeCB);
+  }
   free(n);
 }
 
-/* the current top of the iterator stack */
-#define __tmi_current(it) &it->stack[it->stackOffset - 1]
-
-/* Step itearator return codes below: */
-
-#define TM_ITERSTATE_SELF 0
-#define TM_ITERSTATE_CHILDREN 1
+void TrieMap_Free(TrieMap *t, void (*freeCB)(void *)) {
+  TrieMapNode_Free(t->root, freeCB);
+  free(t);
+}
 
 /* Push a new trie node on the iterator's stack */
-inline void __tmi_Push(TrieMapIterator *it, TrieMapNode *node) {
+static void __tmi_Push(TrieMapIterator *it, void *node) {
   if (it->stackOffset == it->stackCap) {
     it->stackCap += MIN(it->stackCap, 1024);
     it->stack = realloc(it->stack, it->stackCap * sizeof(__tmi_stackNode));
   }
   it->stack[it->stackOffset++] = (__tmi_stackNode){
-      .childOffset = 0,
-      .stringOffset = 0,
       .n = node,
-      .state = TM_ITERSTATE_SELF,
+      .pos = -1,
   };
 }
 
-inline void __tmi_Pop(TrieMapIterator *it) {
-  it->bufOffset -= (__tmi_current(it))->stringOffset;
-  if (it->bufOffset < it->prefixLen) {
-    it->inSuffix = 0;
-  }
-  --it->stackOffset;
-}
-
 TrieMapIterator *TrieMap_Iterate(TrieMap *t, const char *prefix, tm_len_t len) {
   TrieMapIterator *it = calloc(1, sizeof(TrieMapIterator));
 
-  it->bufLen = 16;
-  it->buf = calloc(1, it->bufLen);
   it->stackCap = 8;
   it->stack = calloc(it->stackCap, sizeof(__tmi_stackNode));
-  it->bufOffset = 0;
-  it->inSuffix = 0;
   it->prefix = prefix;
   it->prefixLen = len;
 
-  __tmi_Push(it, t->root);
+  // every key below the prefix's subtree starts with the prefix
+  void *root = TrieMapNode_FindPrefix(t->root, prefix, len);
+  if (root) {
+    __tmi_Push(it, root);
+  }
 
   return it;
 }
 
 void TrieMapIterator_Free(TrieMapIterator *it) {
-  free(it->buf);
   free(it->stack);
   free(it);
 }
 
 int TrieMapIterator_Next(TrieMapIterator *it, char **ptr, tm_len_t *len, void **value) {
   while (it->stackOffset > 0) {
-    __tmi_stackNode *current = __tmi_current(it);
-    TrieMapNode *n = current->n;
-
-    if (current->state == TM_ITERSTATE_SELF) {
-      while (current->stringOffset < n->len) {
-        char b = current->n->str[current->stringOffset];
-        if (!it->inSuffix) {
-          // end of iteration in prefix mode
-          if (it->prefix[it->bufOffset] != b) {
-            goto pop;
-          }
-          if (it->bufOffset == it->prefixLen - 1) {
-            it->inSuffix = 1;
-          }
-        }
-
-        // advance the buffer offset and character offset
-        it->buf[it->bufOffset++] = b;
-        current->stringOffset++;
+    __tmi_stackNode *current = &it->stack[it->stackOffset - 1];
+    TrieMapLeaf *l = NULL;
 
-        // if needed - increase the buffer on the heap
-        if (it->bufOffset == it->bufLen) {
-          it->bufLen *= 2;
-          it->buf = realloc(it->buf, it->bufLen);
-        }
-      }
-
-      // this is required for an empty node to switch to suffix mode
-      if (it->bufOffset == it->prefixLen) {
-        it->inSuffix = 1;
-      }
-      // switch to "children mode"
-      current->state = TM_ITERSTATE_CHILDREN;
-
-      // we've reached
-      if (__trieMapNode_isTerminal(n) && it->inSuffix) {
-        *ptr = it->buf;
-        *len = it->bufOffset;
-        *value = n->value;
-        return 1;
+    if (__isLeaf(current->n)) {
+      l = __leaf(current->n);
+      --it->stackOffset;
+    } else {
+      TrieMapNode *n = current->n;
+      if (current->pos == -1) {
+        // the node's own key comes before its children's keys
+        current->pos = 0;
+        l = n->leaf;
       }
-    }
-
-    if (current->state == TM_ITERSTATE_CHILDREN) {
-      // push the next child that matches
-      tm_len_t nch = current->n->numChildren;
-      while (current->childOffset < nch) {
-        if (it->inSuffix ||
-            *__trieMapNode_childKey(n, current->childOffset) == it->prefix[it->bufOffset]) {
-          TrieMapNode *ch = __trieMapNode_children(n)[current->childOffset++];
-
-          // unless in suffix mode, no need to go back here after popping the
-          // child, so we just set the child offset at the end
-          if (!it->inSuffix) current->childOffset = nch;
-
-          // Add the matching child to the stack
-          __tmi_Push(it, ch);
-
-          goto next;
+      if (!l) {
+        void *child = __trieMapNode_nextChild(n, &current->pos);
+        if (child) {
+          __tmi_Push(it, child);
+        } else {
+          --it->stackOffset;
         }
-        // if the child doesn't match- just advance one
-        current->childOffset++;
+        continue;
       }
     }
-  pop:
-    // at the end of the node - pop and go up
-    __tmi_Pop(it);
-  next:
-    continue;
+
+    *ptr = l->str;
+    *len = l->len;
+    *value = l->value;
+    return 1;
   }
 
   return 0;
 }
 
-void TrieMap_Free(TrieMap *t, void (*freeCB)(void *)) {
-  TrieMapNode_Free(t->root, freeCB);
-  free(t);
-}
-
-TrieMapNode *TrieMapNode_RandomWalk(TrieMapNode *n, int minSteps, char **str, tm_len_t *len) {
-  // create an iteration stack we walk up and down
-  size_t stackCap = minSteps;
-  size_t stackSz = 1;
-  TrieMapNode **stack = calloc(stackCap, sizeof(TrieMapNode *));
-  stack[0] = n;
-
-  size_t bufCap = n->len;
-
-  int steps = 0;
-
-  while (steps < minSteps || !__trieMapNode_isTerminal(stack[stackSz - 1])) {
-    TrieMapNode *n = stack[stackSz - 1];
-
-    /* select the next step - -1 means walk back up one level */
-    int rnd = rand() % (n->numChildren + 1) - 1;
-    if (rnd == -1) {
-      /* we can't walk up the top level */
-      if (stackSz > 1) {
-        steps++;
-        stackSz--;
-        bufCap -= n->len;
-      }
-      continue;
+/* Walk down from a subtree choosing a random child (or the node's own key) at every node.
+ * Returns the leaf we ended up at */
+static TrieMapLeaf *TrieMapNode_RandomWalk(void *p) {
+  while (!__isLeaf(p)) {
+    TrieMapNode *n = p;
+    int rnd = rand() % (n->numChildren + (n->leaf ? 1 : 0));
+    if (rnd == n->numChildren) {
+      return n->leaf;
     }
 
-    /* Push a child on the stack */
-    stack[stackSz++] = n = __trieMapNode_children(n)[rnd];
-    steps++;
-    if (stackSz == stackCap) {
-      stackCap += minSteps;
-      stack = realloc(stack, stackCap);
+    int pos = 0;
+    switch (n->type) {
+      case TM_NODE4:
+      case TM_NODE16:
+        pos = rnd;
+        break;
+      default:
+        // skip rnd children of the sparse node types
+        while (rnd-- > 0) __trieMapNode_nextChild(n, &pos);
     }
-
-    bufCap += n->len;
-  }
-
-  /* Return the node at the top of the stack */
-  n = stack[stackSz - 1];
-
-  /* build the string by walking the stack and copying all node strings */
-  char *buf = malloc(bufCap + 1);
-  buf[bufCap] = 0;
-  tm_len_t bufSize = 0;
-  for (size_t i = 0; i < stackSz; i++) {
-    memcpy(buf + bufSize, stack[i]->str, stack[i]->len);
-    bufSize += stack[i]->len;
+    p = __trieMapNode_nextChild(n, &pos);
   }
-  *str = buf;
-  *len = bufSize;
-  free(stack);
-  return n;
+  return __leaf(p);
 }
 
 void *TrieMap_RandomValueByPrefix(TrieMap *t, const char *prefix, tm_len_t pflen) {
-
-  char *str;
-  tm_len_t len;
-  TrieMapNode *root = TrieMapNode_FindNode(t->root, (char *)prefix, pflen, NULL);
+  void *root = TrieMapNode_FindPrefix(t->root, prefix, pflen);
   if (!root) {
     return NULL;
   }
 
-  TrieMapNode *n = TrieMapNode_RandomWalk(root, (int)round(log2(1 + t->cardinality)), &str, &len);
-  if (n) {
-    free(str);
-    return n->value;
-  }
-  return NULL;
+  return TrieMapNode_RandomWalk(root)->value;
 }
 
 int TrieMap_RandomKey(TrieMap *t, char **str, tm_len_t *len, void **ptr) {
   if (t->cardinality == 0) {
     return 0;
   }
-  // TODO: deduce steps from cardinality properly
-  TrieMapNode *n = TrieMapNode_RandomWalk(t->root, (int)round(log2(1 + t->cardinality)), str, len);
-  *ptr = n->value;
+  TrieMapLeaf *l = TrieMapNode_RandomWalk(t->root);
+
+  char *buf = malloc(l->len + 1);
+  memcpy(buf, l->str, l->len);
+  buf[l->len] = 0;
+  *str = buf;
+  *len = l->len;
+  *ptr = l->value;
   return 1;
 }
@@ -8,39 +8,44 @@
 
 typedef uint16_t tm_len_t;
 
-#define TM_NODE_DELETED 0x01
-#define TM_NODE_TERMINAL 0x02
-#define TM_NODE_SORTED 0x04
-
 /* This special pointer is returned when TrieMap_Find cannot find anything */
 extern void *TRIEMAP_NOTFOUND;
 
-#pragma pack(1)
-
-/* TrieMapNode represents a single node in a trie. The actual size of it is
- * bigger, as the children are allocated after str[].
- * The value pointer is optional, and NULL can be used if you are just
- * interested in the triemap as a set for strings
+/* The trie is an adaptive radix tree: inner nodes come in 4 sizes, holding up to 4, 16, 48 or
+ * 256 children, and grow or shrink between them as children are added and removed. Chains of
+ * single child nodes are compressed into a prefix stored in the node below them.
+ *
+ * Every key is kept in full in a leaf, holding the key's value. Leaves are either children of
+ * inner nodes (tagged in the lowest bit of the child pointer) or, for a key ending exactly at
+ * an inner node, that node's own leaf.
+ *
+ * The value pointer is optional, and NULL can be used if you are just interested in the triemap
+ * as a set for strings
  */
 typedef struct {
-  // the string length of this node. can be 0
+  void *value;
   tm_len_t len;
-  // the number of child nodes
-  tm_len_t numChildren : 9;
+  char str[];
+} TrieMapLeaf;
 
-  uint8_t flags : 7;
+#define TM_NODE4 0
+#define TM_NODE16 1
+#define TM_NODE48 2
+#define TM_NODE256 3
 
-  void *value;
-
-  // the string of the current node
-  char str[];
-  // ... here come the first letters of each child childChars[]
-  // ... now come the children, to be accessed with __trieMapNode_children
+/* The common header of all inner node types. The compressed prefix is allocated right after
+ * the node's children */
+typedef struct {
+  uint8_t type;
+  uint16_t numChildren;
+  // the length of the compressed prefix. can be 0
+  tm_len_t len;
+  // the leaf of the key ending at this node, if there is one
+  TrieMapLeaf *leaf;
 } TrieMapNode;
-#pragma pack()
 
 typedef struct {
-  TrieMapNode *root;
+  void *root;
   size_t cardinality;
 } TrieMap;
 
@@ -81,10 +86,13 @@ int TrieMap_Delete(TrieMap *t, char *str, tm_len_t len, void (*freeCB)(void *));
  * call it to free individual payload values. If not, free() is used instead. */
 void TrieMap_Free(TrieMap *t, void (*freeCB)(void *));
 
-/* Get a random key from the trie by doing a random walk down and up the tree
- * for a minimum number of steps. Returns 0 if the tree is empty and we couldn't
- * find a random node.
- * Assign's the key to str and saves its len (the key is NOT null terminated).
+/* Get a random key from the trie by a single walk down from the root, picking
+ * uniformly at every node among its children and the key ending there, if any.
+ * The keys are not equally likely: a key under a node with few children is
+ * picked more often than one under a node with many. Returns 0 if the tree is
+ * empty.
+ * Assign's a copy of the key to str and saves its len (the copy is null
+ * terminated, but the key may hold null bytes).
  * NOTE: It is the caller's responsibility to free the key string
   */
 int TrieMap_RandomKey(TrieMap *t, char **str, tm_len_t *len, void **ptr);
@@ -95,33 +103,23 @@ void *TrieMap_RandomValueByPrefix(TrieMap *t, const char *prefix, tm_len_t pflen
 
 size_t TrieMap_MemUsage(TrieMap *t);
 
-/**************  Iterator API  - not ported from the textual trie yet
- * ***********/
+/**************  Iterator API  ***********/
 /* trie iterator stack node. for internal use only */
 typedef struct {
-  int state;
-  TrieMapNode *n;
-  tm_len_t stringOffset;
-  tm_len_t childOffset;
+  void *n;
+  // the next child to visit, -1 if the node's own leaf was not visited yet
+  int pos;
 } __tmi_stackNode;
 
 typedef struct {
-  char *buf;
-  tm_len_t bufLen;
-  tm_len_t bufOffset;
-
   __tmi_stackNode *stack;
   tm_len_t stackOffset;
   tm_len_t stackCap;
 
   const char *prefix;
   tm_len_t prefixLen;
-  int inSuffix;
 } TrieMapIterator;
 
-void __tmi_Push(TrieMapIterator *it, TrieMapNode *node);
-void __tmi_Pop(TrieMapIterator *it);
-
 /* Iterate the trie for all the suffixes of a given prefix. This returns an
  * iterator object even if the prefix was not found, and subsequent calls to
  * TrieMapIterator_Next are needed to get the results from the iteration. If the
@@ -133,7 +131,8 @@ TrieMapIterator *TrieMap_Iterate(TrieMap *t, const char *prefix,
 void TrieMapIterator_Free(TrieMapIterator *it);
 
 /* Iterate to the next matching entry in the trie. Returns 1 if we can continue,
- * or 0 if we're done and should exit */
+ * or 0 if we're done and should exit. The key is not NULL terminated, and only valid until the
+ * trie is changed */
 int TrieMapIterator_Next(TrieMapIterator *it, char **ptr, tm_len_t *len,
                          void **value);
 
@@ -0,0 +1,256 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bucket_heap.h"
+
+#define DEFAULT_BUCKET_SIZE 4
+
+static inline bheap_link_t *__link(const bucket_heap_t * h, void *item)
+{
+    return (bheap_link_t *) ((char *)item + h->link_offset);
+}
+
+bucket_heap_t *bheap_new(size_t link_offset)
+{
+    bucket_heap_t *h = malloc(sizeof(bucket_heap_t));
+
+    if (!h)
+        return NULL;
+
+    h->count = 0;
+    h->link_offset = link_offset;
+    h->bucket_bytes = 0;
+    h->spare = NULL;
+    h->buckets = dheap_new(offsetof(bheap_bucket_t, heap_idx));
+    h->index = swiss_new();
+
+    if (!h->buckets || !h->index)
+    {
+        if (h->buckets)
+            dheap_free(h->buckets);
+        if (h->index)
+            swiss_free(h->index);
+        free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+static void __free_bucket(bucket_heap_t * h, bheap_bucket_t * b)
+{
+    h->bucket_bytes -= sizeof(bheap_bucket_t) + b->size * sizeof(void *);
+    free(b->items);
+    free(b);
+}
+
+static void __free_bucket_cb(void *b, void *h)
+{
+    __free_bucket(h, b);
+}
+
+void bheap_free(bucket_heap_t * h)
+{
+    dheap_iterate(h->buckets, __free_bucket_cb, h);
+    if (h->spare)
+        __free_bucket(h, h->spare);
+    dheap_free(h->buckets);
+    swiss_free(h->index);
+    free(h);
+}
+
+/**
+ * Get an empty bucket for a new deadline, and put it in the heap and in the index
+ *
+ * @return the bucket; NULL on failure */
+static bheap_bucket_t *__new_bucket(bucket_heap_t * h, long long deadline)
+{
+    bheap_bucket_t *b = h->spare;
+
+    if (b)
+    {
+        h->spare = NULL;
+    }
+    else
+    {
+        b = malloc(sizeof(bheap_bucket_t));
+        if (!b)
+            return NULL;
+
+        b->items = malloc(DEFAULT_BUCKET_SIZE * sizeof(void *));
+        if (!b->items)
+        {
+            free(b);
+            return NULL;
+        }
+        b->size = DEFAULT_BUCKET_SIZE;
+        h->bucket_bytes += sizeof(bheap_bucket_t) + b->size * sizeof(void *);
+    }
+
+    b->deadline = deadline;
+    b->count = 0;
+
+    if (-1 == dheap_offer(h->buckets, deadline, b))
+    {
+        __free_bucket(h, b);
+        return NULL;
+    }
+
+    /* the index points to the bucket's own deadline, which stays put while it is indexed */
+    if (-1 == swiss_insert(h->index, (const char *)&b->deadline, sizeof(b->deadline), b))
+    {
+        dheap_remove_idx(h->buckets, b->heap_idx);
+        __free_bucket(h, b);
+        return NULL;
+    }
+
+    return b;
+}
+
+/**
+ * Take an empty bucket out of the heap and the index, keeping it as the spare if there is none */
+static void __drop_bucket(bucket_heap_t * h, bheap_bucket_t * b)
+{
+    dheap_remove_idx(h->buckets, b->heap_idx);
+    swiss_delete(h->index, (const char *)&b->deadline, sizeof(b->deadline));
+
+    /* a bucket grown by a large burst is not worth keeping around */
+    if (!h->spare && b->size == DEFAULT_BUCKET_SIZE)
+        h->spare = b;
+    else
+        __free_bucket(h, b);
+}
+
+int bheap_offer(bucket_heap_t * h, long long deadline, void *item)
+{
+    bheap_bucket_t *b = swiss_find(h->index, (const char *)&deadline, sizeof(deadline));
+    bheap_link_t *link = __link(h, item);
+
+    if (!b && !(b = __new_bucket(h, deadline)))
+        return -1;
+
+    if (b->count == b->size)
+    {
+        void **items = realloc(b->items, b->size * 2 * sizeof(void *));
+
+        if (!items)
+            return -1;
+
+        h->bucket_bytes += b->size * sizeof(void *);
+        b->items = items;
+        b->size *= 2;
+    }
+
+    link->bucket = b;
+    link->idx = b->count;
+    b->items[b->count++] = item;
+    h->count++;
+    return 0;
+}
+
+void *bheap_peek(const bucket_heap_t * h)
+{
+    bheap_bucket_t *b = dheap_peek(h->buckets);
+
+    if (!b)
+        return NULL;
+
+    /* the last item of the bucket, so polling it needs no moving */
+    return b->items[b->count - 1];
+}
+
+void *bheap_poll(bucket_heap_t * h)
+{
+    bheap_bucket_t *b = dheap_peek(h->buckets);
+    void *item;
+
+    if (!b)
+        return NULL;
+
+    item = b->items[--b->count];
+    h->count--;
+    if (0 == b->count)
+        __drop_bucket(h, b);
+
+    return item;
+}
+
+unsigned int bheap_poll_due(bucket_heap_t * h, long long deadline, void **out, unsigned int max)
+{
+    unsigned int n = 0;
+    bheap_bucket_t *b;
+
+    while (n < max && (b = dheap_peek(h->buckets)) && b->deadline <= deadline)
+    {
+        /* take the bucket's items from its end, as many as fit */
+        unsigned int take = (b->count < max - n) ? b->count : max - n;
+
+        b->count -= take;
+        memcpy(out + n, b->items + b->count, take * sizeof(void *));
+        n += take;
+        h->count -= take;
+
+        if (0 == b->count)
+            __drop_bucket(h, b);
+    }
+
+    return n;
+}
+
+void bheap_remove(bucket_heap_t * h, void *item)
+{
+    bheap_link_t *link = __link(h, item);
+    bheap_bucket_t *b = link->bucket;
+    void *last = b->items[--b->count];
+
+    /* fill the hole with the bucket's last item */
+    if (link->idx < b->count)
+    {
+        b->items[link->idx] = last;
+        __link(h, last)->idx = link->idx;
+    }
+
+    h->count--;
+    if (0 == b->count)
+        __drop_bucket(h, b);
+}
+
+typedef struct
+{
+    void (*cb) (void *item, void *udata);
+    void *udata;
+} __iterate_ctx;
+
+static void __iterate_bucket(void *bucket, void *udata)
+{
+    bheap_bucket_t *b = bucket;
+    __iterate_ctx *ctx = udata;
+    unsigned int i;
+
+    for (i = 0; i < b->count; i++)
+        ctx->cb(b->items[i], ctx->udata);
+}
+
+void bheap_iterate(const bucket_heap_t * h, void (*cb) (void *item, void *udata), void *udata)
+{
+    __iterate_ctx ctx = { cb, udata };
+
+    dheap_iterate(h->buckets, __iterate_bucket, &ctx);
+}
+
+size_t bheap_memusage(const bucket_heap_t * h)
+{
+    return sizeof(bucket_heap_t) + h->bucket_bytes + dheap_memusage(h->buckets) +
+        swiss_memusage(h->index);
+}
+
+unsigned int bheap_count(const bucket_heap_t * h)
+{
+    return h->count;
+}
+
+unsigned int bheap_bucket_count(const bucket_heap_t * h)
+{
+    return dheap_count(h->buckets);
+}
@@ -0,0 +1,113 @@
+#ifndef BUCKET_HEAP_H
+#define BUCKET_HEAP_H
+#include <stddef.h>
+
+#include "deadline_heap.h"
+#include "swiss_table.h"
+
+/* Heap of deadline buckets, for items arriving in bursts with identical millisecond deadlines.
+ *
+ * All items due at the same deadline share a bucket, an array of items, and only the buckets are
+ * ordered, in a 4-ary deadline heap. A hash table from deadline to bucket finds the bucket of an
+ * offered deadline in O(1), so offering an item due at a deadline already in the heap is an
+ * array append, the heap's size is the number of distinct deadlines rather than the number of
+ * items, and draining a bucket is a walk over its array. Items sharing a deadline come out in no
+ * particular order.
+ *
+ * Items keep track of where they are (needed for bheap_remove): the heap writes the item's
+ * bucket and index into the bheap_link_t found at link_offset inside the item every time it
+ * moves it. */
+
+typedef struct
+{
+    struct bheap_bucket_s *bucket;
+    unsigned int idx;
+} bheap_link_t;
+
+typedef struct bheap_bucket_s
+{
+    long long deadline;
+    /* index of the bucket in the heap of buckets */
+    unsigned int heap_idx;
+    /* items within bucket */
+    unsigned int count;
+    /* slots allocated */
+    unsigned int size;
+    void **items;
+} bheap_bucket_t;
+
+typedef struct bucket_heap_s
+{
+    /* items within heap */
+    unsigned int count;
+    /* offset of the item's bheap_link_t */
+    size_t link_offset;
+    /* bytes held by the buckets and their arrays */
+    size_t bucket_bytes;
+    dheap_t *buckets;
+    /* deadline -> bucket, keyed on the bucket's own deadline field */
+    swiss_table_t *index;
+    /* an emptied bucket, kept for the next new deadline */
+    bheap_bucket_t *spare;
+} bucket_heap_t;
+
+/**
+ * Create new empty heap.
+ *
+ * @param[in] link_offset Offset of a bheap_link_t inside items, kept up to date by the heap
+ * @return initialised heap; NULL on failure */
+bucket_heap_t *bheap_new(size_t link_offset);
+
+/**
+ * Free the heap. Does not free items. */
+void bheap_free(bucket_heap_t *h);
+
+/**
+ * Add item.
+ *
+ * O(1) if a bucket for the deadline exists, O(log b) for a new deadline, b being the number of
+ * distinct deadlines.
+ *
+ * @param[in] deadline The item's priority, smallest first
+ * @return 0 on success; -1 on failure */
+int bheap_offer(bucket_heap_t *h, long long deadline, void *item);
+
+/**
+ * @return an item with the smallest deadline; NULL if empty */
+void *bheap_peek(const bucket_heap_t *h);
+
+/**
+ * Remove an item with the smallest deadline
+ *
+ * @return the item; NULL if empty */
+void *bheap_poll(bucket_heap_t *h);
+
+/**
+ * Remove items due at or before deadline, in order of deadline, up to max of them.
+ *
+ * @param[out] out Receives the removed items
+ * @return number of items removed */
+unsigned int bheap_poll_due(bucket_heap_t *h, long long deadline, void **out, unsigned int max);
+
+/**
+ * Remove an item, wherever it is in the heap */
+void bheap_remove(bucket_heap_t *h, void *item);
+
+/**
+ * Call cb for every item in the heap, in no particular order.
+ * The heap must not be changed until iteration is done. */
+void bheap_iterate(const bucket_heap_t *h, void (*cb) (void *item, void *udata), void *udata);
+
+/**
+ * @return number of bytes held by the heap */
+size_t bheap_memusage(const bucket_heap_t *h);
+
+/**
+ * @return number of items in heap */
+unsigned int bheap_count(const bucket_heap_t *h);
+
+/**
+ * @return number of distinct deadlines in heap */
+unsigned int bheap_bucket_count(const bucket_heap_t *h);
+
+#endif /* BUCKET_HEAP_H */
@@ -0,0 +1,317 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "deadline_heap.h"
+
+#define DEFAULT_DIR_SIZE 8
+#define CACHE_LINE 64
+
+/* entries in front of the root, so that the children 4i+1 .. 4i+4 of every node i share a line */
+#define PAD (DHEAP_ARITY - 1)
+
+static inline dheap_entry_t *__entry(const dheap_t * h, unsigned int idx)
+{
+    unsigned int pos = idx + PAD;
+
+    return &h->dir[pos >> DHEAP_CHUNK_BITS][pos & DHEAP_CHUNK_MASK];
+}
+
+/**
+ * @return 0 on success; -1 on failure */
+static int __add_chunk(dheap_t * h)
+{
+    void *chunk;
+
+    if (h->chunks == h->dir_size)
+    {
+        /* only the directory is reallocated, the entries stay where they are */
+        dheap_entry_t **dir = realloc(h->dir, h->dir_size * 2 * sizeof(dheap_entry_t *));
+
+        if (!dir)
+            return -1;
+
+        h->dir = dir;
+        h->dir_size *= 2;
+    }
+
+    if (0 != posix_memalign(&chunk, CACHE_LINE, DHEAP_CHUNK_SIZE * sizeof(dheap_entry_t)))
+        return -1;
+
+    h->dir[h->chunks++] = chunk;
+    return 0;
+}
+
+dheap_t *dheap_new(size_t idx_offset)
+{
+    dheap_t *h = malloc(sizeof(dheap_t));
+
+    if (!h)
+        return NULL;
+
+    h->dir = malloc(DEFAULT_DIR_SIZE * sizeof(dheap_entry_t *));
+    h->dir_size = DEFAULT_DIR_SIZE;
+    h->chunks = 0;
+    h->count = 0;
+    h->idx_offset = idx_offset;
+
+    if (!h->dir || -1 == __add_chunk(h))
+    {
+        free(h->dir);
+        free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+void dheap_free(dheap_t * h)
+{
+    while (h->chunks)
+        free(h->dir[--h->chunks]);
+    free(h->dir);
+    free(h);
+}
+
+/**
+ * @return 0 on success; -1 on failure */
+static int __ensurecapacity(dheap_t * h)
+{
+    if (h->count + PAD < h->chunks << DHEAP_CHUNK_BITS)
+        return 0;
+
+    return __add_chunk(h);
+}
+
+/**
+ * Release the last chunk once the one before it is empty as well */
+static void __shrink(dheap_t * h)
+{
+    while (1 < h->chunks && h->count + PAD <= (h->chunks - 2) << DHEAP_CHUNK_BITS)
+        free(h->dir[--h->chunks]);
+}
+
+/**
+ * Store an entry at an index and let its item know where it is */
+static inline void __place(dheap_t * h, dheap_entry_t * slot, unsigned int idx, dheap_entry_t e)
+{
+    *slot = e;
+    if (h->idx_offset != DHEAP_NO_IDX)
+        *(unsigned int *)((char *)e.item + h->idx_offset) = idx;
+}
+
+/**
+ * Move the hole at idx up until e fits in it */
+static void __sift_up(dheap_t * h, unsigned int idx, dheap_entry_t e)
+{
+    dheap_entry_t *slot = __entry(h, idx);
+
+    while (0 < idx)
+    {
+        unsigned int parent = (idx - 1) / DHEAP_ARITY;
+        dheap_entry_t *p = __entry(h, parent);
+
+        if (p->deadline <= e.deadline)
+            break;
+
+        __place(h, slot, idx, *p);
+        slot = p;
+        idx = parent;
+    }
+    __place(h, slot, idx, e);
+}
+
+/**
+ * Move the hole at idx down until e fits in it */
+static void __sift_down(dheap_t * h, unsigned int idx, dheap_entry_t e)
+{
+    dheap_entry_t *slot = __entry(h, idx);
+    unsigned int count = h->count;
+
+    for (;;)
+    {
+        unsigned int first = idx * DHEAP_ARITY + 1;
+        unsigned int min, i;
+        dheap_entry_t *c;
+        long long min_deadline;
+
+        if (count <= first)
+            break;
+
+        /* the four child groups of our children, one cache line each */
+        for (i = 0; i < DHEAP_ARITY; i++)
+        {
+            unsigned int gc = (first + i) * DHEAP_ARITY + 1;
+
+            if (count <= gc)
+                break;
+            __builtin_prefetch(__entry(h, gc));
+        }
+
+        /* a group of children never crosses a chunk */
+        c = __entry(h, first);
+        min = 0;
+        min_deadline = c[0].deadline;
+        if (first + DHEAP_ARITY <= count)
+        {
+            /* full group: no loop bound to check, compiles to conditional moves */
+            for (i = 1; i < DHEAP_ARITY; i++)
+            {
+                int less = c[i].deadline < min_deadline;
+
+                min = less ? i : min;
+                min_deadline = less ? c[i].deadline : min_deadline;
+            }
+        }
+        else
+        {
+            for (i = 1; first + i < count; i++)
+            {
+                if (c[i].deadline < min_deadline)
+                {
+                    min = i;
+                    min_deadline = c[i].deadline;
+                }
+            }
+        }
+
+        if (e.deadline <= min_deadline)
+            break;
+
+        __place(h, slot, idx, c[min]);
+        slot = &c[min];
+        idx = first + min;
+    }
+    __place(h, slot, idx, e);
+}
+
+int dheap_offer(dheap_t * h, long long deadline, void *item)
+{
+    dheap_entry_t e;
+
+    if (-1 == __ensurecapacity(h))
+        return -1;
+
+    e.deadline = deadline;
+    e.item = item;
+    __sift_up(h, h->count++, e);
+    return 0;
+}
+
+/**
+ * Restore the heap property over the whole array, bottom up (Floyd) - O(n) */
+static void __heapify(dheap_t * h)
+{
+    unsigned int idx;
+
+    if (h->count < 2)
+        return;
+
+    idx = (h->count - 2) / DHEAP_ARITY + 1;
+    while (0 < idx--)
+        __sift_down(h, idx, *__entry(h, idx));
+}
+
+unsigned int dheap_offer_batch(dheap_t * h, const dheap_entry_t * entries, unsigned int n)
+{
+    unsigned int before = h->count;
+    unsigned int i;
+
+    /* append without ordering anything yet */
+    for (i = 0; i < n; i++)
+    {
+        if (-1 == __ensurecapacity(h))
+            break;
+
+        __place(h, __entry(h, h->count), h->count, entries[i]);
+        h->count++;
+    }
+
+    /* rebuilding costs O(count). sifting up a new entry is O(log count) at worst, but O(1) on
+     * average for random deadlines, so it only pays off for a batch as large as the heap */
+    if (before <= i)
+    {
+        __heapify(h);
+    }
+    else
+    {
+        unsigned int idx;
+
+        for (idx = before; idx < h->count; idx++)
+            __sift_up(h, idx, *__entry(h, idx));
+    }
+
+    return i;
+}
+
+void *dheap_peek(const dheap_t * h)
+{
+    if (0 == h->count)
+        return NULL;
+
+    return __entry(h, 0)->item;
+}
+
+long long dheap_peek_deadline(const dheap_t * h)
+{
+    return __entry(h, 0)->deadline;
+}
+
+void *dheap_remove_idx(dheap_t * h, unsigned int idx)
+{
+    void *item;
+    dheap_entry_t last;
+
+    if (idx >= h->count)
+        return NULL;
+
+    item = __entry(h, idx)->item;
+    last = *__entry(h, --h->count);
+
+    if (idx < h->count)
+    {
+        if (0 < idx && last.deadline < __entry(h, (idx - 1) / DHEAP_ARITY)->deadline)
+            __sift_up(h, idx, last);
+        else
+            __sift_down(h, idx, last);
+    }
+
+    __shrink(h);
+    return item;
+}
+
+void *dheap_poll(dheap_t * h)
+{
+    return dheap_remove_idx(h, 0);
+}
+
+void dheap_update_idx(dheap_t * h, unsigned int idx, long long deadline)
+{
+    dheap_entry_t e = *__entry(h, idx);
+    long long old = e.deadline;
+
+    e.deadline = deadline;
+    if (deadline < old)
+        __sift_up(h, idx, e);
+    else
+        __sift_down(h, idx, e);
+}
+
+void dheap_iterate(const dheap_t * h, void (*cb) (void *item, void *udata), void *udata)
+{
+    unsigned int i;
+
+    for (i = 0; i < h->count; i++)
+        cb(__entry(h, i)->item, udata);
+}
+
+size_t dheap_memusage(const dheap_t * h)
+{
+    return sizeof(dheap_t) + h->dir_size * sizeof(dheap_entry_t *) +
+        (size_t)h->chunks * DHEAP_CHUNK_SIZE * sizeof(dheap_entry_t);
+}
+
+unsigned int dheap_count(const dheap_t * h)
+{
+    return h->count;
+}
@@ -0,0 +1,118 @@
+#ifndef DEADLINE_HEAP_H
+#define DEADLINE_HEAP_H
+#include <stdlib.h>
+
+/* 4-ary min-heap specialized for millisecond deadlines.
+ *
+ * Unlike heap_t, every entry carries its deadline inline next to the item pointer, so ordering
+ * never dereferences an item and never calls through a comparator. A node's four children are
+ * 16 byte entries sharing a single, aligned, 64 byte cache line, and the next level is
+ * prefetched while sifting down.
+ *
+ * The array is split into fixed size chunks found through a directory, so growing never moves
+ * the entries already stored (only the small directory of chunk pointers is ever reallocated),
+ * and chunks emptied by a drain are given back, keeping one spare chunk to avoid thrashing when
+ * the heap's size hovers around a chunk boundary.
+ *
+ * Items can keep track of their own index in the heap (needed for dheap_remove_idx and
+ * dheap_update_idx): the heap writes the index into the unsigned int found at idx_offset inside
+ * the item every time it moves it. */
+
+#define DHEAP_ARITY 4
+
+/* 4096 entries, 64KB per chunk */
+#define DHEAP_CHUNK_BITS 12
+#define DHEAP_CHUNK_SIZE (1U << DHEAP_CHUNK_BITS)
+#define DHEAP_CHUNK_MASK (DHEAP_CHUNK_SIZE - 1)
+
+typedef struct
+{
+    long long deadline;
+    void *item;
+} dheap_entry_t;
+
+typedef struct dheap_s
+{
+    /* items within heap */
+    unsigned int count;
+    /* chunks allocated */
+    unsigned int chunks;
+    /* slots in the chunk directory */
+    unsigned int dir_size;
+    /* offset of the item's index field, or DHEAP_NO_IDX */
+    size_t idx_offset;
+    /* cache line aligned chunks. Entry 0, the root, is preceded by padding, so the children of
+     * any node start on a cache line boundary and never cross a chunk */
+    dheap_entry_t **dir;
+} dheap_t;
+
+/* pass as idx_offset when items do not track their index */
+#define DHEAP_NO_IDX ((size_t)-1)
+
+/**
+ * Create new heap and initialise it.
+ *
+ * @param[in] idx_offset Offset of an unsigned int inside items, updated with the item's index
+ * @return initialised heap; NULL on failure */
+dheap_t *dheap_new(size_t idx_offset);
+
+/**
+ * Free the heap. Does not free items. */
+void dheap_free(dheap_t * h);
+
+/**
+ * Add item
+ *
+ * @param[in] deadline The item's priority, smallest first
+ * @param[in] item The item to be added
+ * @return 0 on success; -1 on failure */
+int dheap_offer(dheap_t * h, long long deadline, void *item);
+
+/**
+ * Add a batch of items at once.
+ *
+ * A batch at least as large as the heap is appended as is, and the whole heap is rebuilt
+ * bottom up in O(n) rather than sifting up every entry on its own.
+ *
+ * @param[in] entries The items to be added, with their deadlines
+ * @return number of items added, the first ones of entries; less than n on failure */
+unsigned int dheap_offer_batch(dheap_t * h, const dheap_entry_t * entries, unsigned int n);
+
+/**
+ * @return top item of the heap; NULL if empty */
+void *dheap_peek(const dheap_t * h);
+
+/**
+ * @return deadline of the top item; undefined if empty */
+long long dheap_peek_deadline(const dheap_t * h);
+
+/**
+ * Remove the item with the smallest deadline
+ *
+ * @return top item; NULL if empty */
+void *dheap_poll(dheap_t * h);
+
+/**
+ * Remove the item at the given index
+ *
+ * @return the removed item; NULL if idx is out of bounds */
+void *dheap_remove_idx(dheap_t * h, unsigned int idx);
+
+/**
+ * Change the deadline of the item at the given index (decrease/increase key) */
+void dheap_update_idx(dheap_t * h, unsigned int idx, long long deadline);
+
+/**
+ * Call cb for every item in the heap, in array order.
+ * The heap must not be changed until iteration is done. */
+void dheap_iterate(const dheap_t * h, void (*cb) (void *item, void *udata), void *udata);
+
+/**
+ * @return number of bytes held by the heap */
+size_t dheap_memusage(const dheap_t * h);
+
+/**
+ * @return number of items in heap */
+unsigned int dheap_count(const dheap_t * h);
+
+#endif /* DEADLINE_HEAP_H */
@@ -0,0 +1,100 @@
+
+#include <stdlib.h>
+
+#include "mempool.h"
+
+/* keep elements pointer aligned after the slab header */
+#define SLAB_HEADER_SIZE ((sizeof(mempool_slab_t) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static void *(*__alloc) (size_t) = malloc;
+static void (*__free) (void *) = free;
+
+void mempool_set_allocator(void *(*alloc) (size_t), void (*free) (void *))
+{
+    __alloc = alloc;
+    __free = free;
+}
+
+mempool_t *mempool_new(size_t elem_size, unsigned int slab_elems)
+{
+    mempool_t *p = __alloc(sizeof(mempool_t));
+
+    if (!p)
+        return NULL;
+
+    if (elem_size < sizeof(void *))
+        elem_size = sizeof(void *);
+
+    p->elem_size = (elem_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    p->slab_elems = slab_elems ? slab_elems : 1;
+    p->count = 0;
+    p->slabs = 0;
+    p->free_list = NULL;
+    p->unused = p->unused_end = NULL;
+    p->slab_list = NULL;
+
+    return p;
+}
+
+void mempool_free(mempool_t * p)
+{
+    while (p->slab_list)
+    {
+        mempool_slab_t *next = p->slab_list->next;
+
+        __free(p->slab_list);
+        p->slab_list = next;
+    }
+    __free(p);
+}
+
+/**
+ * @return 0 on success; -1 on failure */
+static int __grow(mempool_t * p)
+{
+    mempool_slab_t *slab = __alloc(SLAB_HEADER_SIZE + p->slab_elems * p->elem_size);
+
+    if (!slab)
+        return -1;
+
+    slab->next = p->slab_list;
+    p->slab_list = slab;
+    p->slabs++;
+
+    p->unused = (char *)slab + SLAB_HEADER_SIZE;
+    p->unused_end = p->unused + p->slab_elems * p->elem_size;
+    return 0;
+}
+
+void *mempool_alloc(mempool_t * p)
+{
+    void *elem = p->free_list;
+
+    if (elem)
+    {
+        p->free_list = *(void **)elem;
+    }
+    else
+    {
+        if (p->unused == p->unused_end && __grow(p) != 0)
+            return NULL;
+
+        elem = p->unused;
+        p->unused += p->elem_size;
+    }
+
+    p->count++;
+    return elem;
+}
+
+void mempool_release(mempool_t * p, void *elem)
+{
+    *(void **)elem = p->free_list;
+    p->free_list = elem;
+    p->count--;
+}
+
+size_t mempool_memusage(const mempool_t * p)
+{
+    return sizeof(mempool_t) + p->slabs * (SLAB_HEADER_SIZE + p->slab_elems * p->elem_size);
+}
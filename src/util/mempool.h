@@ -0,0 +1,73 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+#include <stdlib.h>
+
+/* Fixed size slab pool.
+ *
+ * Elements are carved out of slabs holding many elements each, and released elements are kept
+ * on a free list to be handed out again, so steady state alloc/release never reaches the
+ * allocator. Slabs are only given back when the pool itself is freed.
+ *
+ * Slabs are allocated through the functions set with mempool_set_allocator (malloc/free by
+ * default), which lets a redis module account for the pool's memory. */
+
+typedef struct mempool_slab_s
+{
+    struct mempool_slab_s *next;
+} mempool_slab_t;
+
+typedef struct mempool_s
+{
+    /* size of a single element, at least a pointer */
+    size_t elem_size;
+    /* number of elements per slab */
+    unsigned int slab_elems;
+    /* elements handed out */
+    size_t count;
+    /* number of slabs allocated */
+    size_t slabs;
+    /* released elements, linked through their first word */
+    void *free_list;
+    /* elements of the newest slab that were never handed out */
+    char *unused;
+    char *unused_end;
+    mempool_slab_t *slab_list;
+} mempool_t;
+
+/**
+ * Set the allocator used for all slabs from now on.
+ * Must be called before any pool allocates its first slab.
+ *
+ * @param[in] alloc malloc() like allocation function
+ * @param[in] free free() like release function */
+void mempool_set_allocator(void *(*alloc) (size_t), void (*free) (void *));
+
+/**
+ * Create new pool.
+ *
+ * @param[in] elem_size Size of the pool's elements
+ * @param[in] slab_elems Number of elements allocated at once
+ * @return initialised pool; NULL on failure */
+mempool_t *mempool_new(size_t elem_size, unsigned int slab_elems);
+
+/**
+ * Free the pool and all of its slabs, including elements that were not released. */
+void mempool_free(mempool_t * p);
+
+/**
+ * Get an element
+ *
+ * @return uninitialised element; NULL on failure */
+void *mempool_alloc(mempool_t * p);
+
+/**
+ * Give an element back to the pool
+ *
+ * @param[in] elem Element previously returned by mempool_alloc of the same pool */
+void mempool_release(mempool_t * p, void *elem);
+
+/**
+ * @return number of bytes held by the pool's slabs */
+size_t mempool_memusage(const mempool_t * p);
+
+#endif /* MEMPOOL_H */
@@ -0,0 +1,110 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpsc_queue.h"
+
+static inline size_t *__seq(const mpsc_queue_t * q, size_t pos)
+{
+    return (size_t *) (q->slots + (pos & q->mask) * q->slot_size);
+}
+
+mpsc_queue_t *mpsc_new(size_t capacity, size_t elem_size)
+{
+    mpsc_queue_t *q;
+    size_t slots = 1, i;
+
+    while (slots < capacity)
+        slots <<= 1;
+
+    if (posix_memalign((void **)&q, MPSC_CACHE_LINE, sizeof(mpsc_queue_t)))
+        return NULL;
+
+    q->mask = slots - 1;
+    q->elem_size = elem_size;
+    /* keep every slot's sequence number aligned */
+    q->slot_size = (sizeof(size_t) + elem_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    q->slots = malloc(slots * q->slot_size);
+    if (!q->slots)
+    {
+        free(q);
+        return NULL;
+    }
+
+    /* slot i is free for the producer at position i */
+    for (i = 0; i < slots; i++)
+        *__seq(q, i) = i;
+    q->head = 0;
+    q->tail = 0;
+
+    return q;
+}
+
+void mpsc_free(mpsc_queue_t * q)
+{
+    free(q->slots);
+    free(q);
+}
+
+int mpsc_push(mpsc_queue_t * q, const void *elem)
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t *seq;
+
+    for (;;)
+    {
+        seq = __seq(q, pos);
+        intptr_t dif = (intptr_t) __atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t) pos;
+
+        if (0 == dif)
+        {
+            /* the slot is free, claim its position; on failure pos is reloaded */
+            if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (dif < 0)
+        {
+            /* the slot still holds the element pushed a lap ago */
+            return -1;
+        }
+        else
+        {
+            /* another producer took the position */
+            pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(seq + 1, elem, q->elem_size);
+    __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int mpsc_pop(mpsc_queue_t * q, void *out)
+{
+    size_t pos = q->tail;
+    size_t *seq = __seq(q, pos);
+
+    if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return -1;
+
+    memcpy(out, seq + 1, q->elem_size);
+    /* free the slot for the producer a lap ahead */
+    __atomic_store_n(seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->tail, pos + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+size_t mpsc_count(const mpsc_queue_t * q)
+{
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    return head > tail ? head - tail : 0;
+}
+
+size_t mpsc_capacity(const mpsc_queue_t * q)
+{
+    return q->mask + 1;
+}
@@ -0,0 +1,64 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+#include <stddef.h>
+
+/* Bounded lock-free queue for many producers and a single consumer.
+ *
+ * Elements are fixed size and copied into a ring of slots, so pushing never allocates. Every
+ * slot carries a sequence number telling whether it is free for the producer at a given position
+ * or holds an element for the consumer at it: producers claim a position with a single compare
+ * and swap on the head, write their element, and publish it by advancing the slot's sequence.
+ * The consumer owns the tail and needs no atomic read-modify-write at all.
+ *
+ * Any number of threads may push at once. Only one thread at a time may pop, e.g. the one
+ * holding a lock of the caller's. */
+
+#define MPSC_CACHE_LINE 64
+
+typedef struct mpsc_queue_s
+{
+    /* slots - 1, the number of slots being a power of 2 */
+    size_t mask;
+    size_t elem_size;
+    /* bytes per slot, its sequence number followed by the element */
+    size_t slot_size;
+    char *slots;
+    /* next position to push, shared by producers */
+    size_t head __attribute__ ((aligned(MPSC_CACHE_LINE)));
+    /* next position to pop, the consumer's own */
+    size_t tail __attribute__ ((aligned(MPSC_CACHE_LINE)));
+} mpsc_queue_t;
+
+/**
+ * Create new empty queue.
+ *
+ * @param[in] capacity Most elements held at once, rounded up to a power of 2
+ * @param[in] elem_size Size of the elements
+ * @return initialised queue; NULL on failure */
+mpsc_queue_t *mpsc_new(size_t capacity, size_t elem_size);
+
+/**
+ * Free the queue. Elements still in it are dropped. */
+void mpsc_free(mpsc_queue_t *q);
+
+/**
+ * Copy an element into the queue. Safe to call from any number of threads.
+ *
+ * @return 0 on success; -1 if the queue is full */
+int mpsc_push(mpsc_queue_t *q, const void *elem);
+
+/**
+ * Copy the oldest element out of the queue. Only one thread at a time may pop.
+ *
+ * @return 0 on success; -1 if the queue is empty */
+int mpsc_pop(mpsc_queue_t *q, void *out);
+
+/**
+ * @return number of elements in the queue, which may be stale by the time it returns */
+size_t mpsc_count(const mpsc_queue_t *q);
+
+/**
+ * @return most elements held at once */
+size_t mpsc_capacity(const mpsc_queue_t *q);
+
+#endif /* MPSC_QUEUE_H */
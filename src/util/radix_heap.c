@@ -0,0 +1,194 @@
+
+#include <stdlib.h>
+
+#include "radix_heap.h"
+
+static int __bucket_of(long long last, long long deadline)
+{
+    unsigned long long diff = (unsigned long long)(deadline ^ last);
+
+    if (0 == diff)
+        return 0;
+
+    return 64 - __builtin_clzll(diff);
+}
+
+radix_heap_t *radix_new(void)
+{
+    radix_heap_t *r = calloc(1, sizeof(radix_heap_t));
+
+    return r;
+}
+
+void radix_free(radix_heap_t * r)
+{
+    free(r);
+}
+
+static void __link(radix_heap_t * r, radix_node_t * n)
+{
+    int bucket = __bucket_of(r->last, n->deadline);
+    radix_node_t **head = &r->buckets[bucket];
+
+    n->bucket = bucket;
+    n->prev = NULL;
+    n->next = *head;
+    if (*head)
+        (*head)->prev = n;
+    *head = n;
+
+    if (bucket)
+        r->occupied |= 1ULL << (bucket - 1);
+}
+
+static void __unlink(radix_heap_t * r, radix_node_t * n)
+{
+    int bucket = n->bucket;
+
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        r->buckets[bucket] = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+
+    if (bucket && NULL == r->buckets[bucket])
+        r->occupied &= ~(1ULL << (bucket - 1));
+
+    n->next = n->prev = NULL;
+}
+
+/**
+ * Take every node out of a bucket and link it again relative to the current last deadline */
+static void __relink_bucket(radix_heap_t * r, int bucket)
+{
+    radix_node_t *n = r->buckets[bucket];
+
+    r->buckets[bucket] = NULL;
+    if (bucket)
+        r->occupied &= ~(1ULL << (bucket - 1));
+
+    while (n)
+    {
+        radix_node_t *next = n->next;
+
+        __link(r, n);
+        n = next;
+    }
+}
+
+/**
+ * Re-link all nodes relative to a new, earlier, last deadline */
+static void __rebase(radix_heap_t * r, long long last)
+{
+    radix_node_t *all = NULL;
+    int bucket;
+
+    for (bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+    {
+        radix_node_t *n = r->buckets[bucket];
+
+        while (n)
+        {
+            radix_node_t *next = n->next;
+
+            n->next = all;
+            all = n;
+            n = next;
+        }
+        r->buckets[bucket] = NULL;
+    }
+    r->occupied = 0;
+
+    r->last = last;
+    while (all)
+    {
+        radix_node_t *next = all->next;
+
+        __link(r, all);
+        all = next;
+    }
+}
+
+void radix_offer(radix_heap_t * r, radix_node_t * node, long long deadline)
+{
+    node->deadline = deadline;
+
+    if (deadline < r->last)
+        __rebase(r, deadline);
+
+    __link(r, node);
+    r->count++;
+
+    if (r->min && deadline < r->min->deadline)
+        r->min = node;
+}
+
+radix_node_t *radix_peek(radix_heap_t * r)
+{
+    if (0 == r->count)
+        return NULL;
+
+    /* nothing stored is earlier than the last deadline */
+    if (r->buckets[0])
+        return r->buckets[0];
+
+    if (NULL == r->min)
+    {
+        /* every deadline in the lowest non empty bucket is smaller than any deadline above it */
+        int bucket = __builtin_ctzll(r->occupied) + 1;
+        radix_node_t *n;
+
+        r->min = r->buckets[bucket];
+        for (n = r->min->next; n; n = n->next)
+            if (n->deadline < r->min->deadline)
+                r->min = n;
+    }
+
+    return r->min;
+}
+
+radix_node_t *radix_poll(radix_heap_t * r)
+{
+    radix_node_t *n = radix_peek(r);
+
+    if (NULL == n)
+        return NULL;
+
+    if (n->bucket)
+    {
+        /* moving up to the minimum spreads its bucket over lower buckets, n lands in 0 */
+        r->last = n->deadline;
+        __relink_bucket(r, n->bucket);
+    }
+
+    radix_remove(r, n);
+    return n;
+}
+
+void radix_remove(radix_heap_t * r, radix_node_t * node)
+{
+    if (node == r->min)
+        r->min = NULL;
+    __unlink(r, node);
+    r->count--;
+}
+
+void radix_iterate(const radix_heap_t * r, void (*cb) (radix_node_t * node, void *udata),
+                   void *udata)
+{
+    int bucket;
+
+    for (bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+    {
+        radix_node_t *n;
+
+        for (n = r->buckets[bucket]; n; n = n->next)
+            cb(n, udata);
+    }
+}
+
+unsigned int radix_count(const radix_heap_t * r)
+{
+    return r->count;
+}
@@ -0,0 +1,101 @@
+#ifndef RADIX_HEAP_H
+#define RADIX_HEAP_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Radix heap keyed on millisecond deadlines.
+ *
+ * Buckets are relative to the last deadline polled out of the heap: bucket 0 holds the nodes due
+ * exactly at it, and bucket b > 0 the nodes whose deadline first differs from it in bit b - 1, so
+ * an insert is a single bit scan. When bucket 0 runs empty, a poll scans the first non empty
+ * bucket for its minimum, which becomes the new last deadline, and spreads the bucket's nodes
+ * over lower buckets. A node only ever moves to lower buckets, making the poll amortized
+ * O(log C), C being the largest distance between a deadline and the last one.
+ *
+ * Meant for deadlines that only move forward, like a clock: offering a deadline earlier than the
+ * last one polled re-buckets every node, O(n). Peeking only finds and remembers the minimum and
+ * leaves the last deadline alone, so deadlines earlier than the one peeked stay O(1) to offer.
+ *
+ * Nodes are intrusive: embed a radix_node_t in your own struct and use radix_entry() to get
+ * back to it. The heap never allocates per node. */
+
+/* bucket 0 plus one bucket per bit of a 64 bit deadline */
+#define RADIX_BUCKETS 65
+
+typedef struct radix_node_s
+{
+    struct radix_node_s *next;
+    struct radix_node_s *prev;
+    long long deadline;
+    unsigned char bucket;
+} radix_node_t;
+
+typedef struct radix_heap_s
+{
+    /* the last deadline polled out, no stored deadline is smaller */
+    long long last;
+    /* the earliest node outside bucket 0 as found by a peek, NULL until the next peek */
+    struct radix_node_s *min;
+    /* nodes within heap */
+    unsigned int count;
+    /* one bit per non empty bucket, bucket b > 0 is bit b - 1 */
+    uint64_t occupied;
+    radix_node_t *buckets[RADIX_BUCKETS];
+} radix_heap_t;
+
+/**
+ * Get the struct containing the given radix node */
+#define radix_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * Create new empty heap.
+ *
+ * @return initialised heap; NULL on failure */
+radix_heap_t *radix_new(void);
+
+/**
+ * Free the heap. Does not touch the nodes still linked into it. */
+void radix_free(radix_heap_t *r);
+
+/**
+ * Add node with the given deadline.
+ *
+ * O(1), unless the deadline is earlier than a deadline already polled out of the heap, in which
+ * case all nodes are re-bucketed relative to the new deadline.
+ *
+ * @param[in] node The node to be added, must not be linked into any heap
+ * @param[in] deadline Absolute deadline in milliseconds */
+void radix_offer(radix_heap_t *r, radix_node_t *node, long long deadline);
+
+/**
+ * O(1) while the minimum is known, otherwise a scan of the first non empty bucket.
+ *
+ * @return node with the earliest deadline; NULL if the heap is empty */
+radix_node_t *radix_peek(radix_heap_t *r);
+
+/**
+ * Remove the node with the earliest deadline
+ *
+ * @return the removed node; NULL if the heap is empty */
+radix_node_t *radix_poll(radix_heap_t *r);
+
+/**
+ * Remove a node linked into the heap
+ *
+ * O(1).
+ *
+ * @param[in] node The node to be removed */
+void radix_remove(radix_heap_t *r, radix_node_t *node);
+
+/**
+ * Call cb for every node in the heap, in no particular order.
+ * The heap must not be changed until iteration is done. */
+void radix_iterate(const radix_heap_t *r, void (*cb) (radix_node_t *node, void *udata),
+                   void *udata);
+
+/**
+ * @return number of nodes in heap */
+unsigned int radix_count(const radix_heap_t *r);
+
+#endif /* RADIX_HEAP_H */
@@ -0,0 +1,291 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "swiss_table.h"
+
+#define CTRL_EMPTY ((int8_t)0x80)
+#define CTRL_DELETED ((int8_t)0xFE)
+/* full slots hold the low 7 bits of their key's hash, empty and deleted ones have the top bit */
+#define TAG_MASK 0x7f
+
+#define DEFAULT_CAPACITY SWISS_GROUP_SIZE
+
+static uint64_t __hash(const char *key, size_t len)
+{
+    const uint64_t m = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = len * m;
+    uint64_t k;
+
+    for (; len >= 8; key += 8, len -= 8)
+    {
+        memcpy(&k, key, 8);
+        h = (h ^ k) * m;
+        h ^= h >> 29;
+    }
+    if (len)
+    {
+        k = 0;
+        memcpy(&k, key, len);
+        h = (h ^ k) * m;
+    }
+
+    /* spread every bit over the position and the tag */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @return a bit mask of the control bytes in the group equal to c */
+static inline unsigned int __match(const int8_t * group, int8_t c)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SWISS_GROUP_SIZE; i++)
+        mask |= (unsigned int)(group[i] == c) << i;
+    return mask;
+#endif
+}
+
+/**
+ * @return a bit mask of the empty or deleted slots in the group */
+static inline unsigned int __match_free(const int8_t * group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < SWISS_GROUP_SIZE; i++)
+        mask |= (unsigned int)(group[i] < 0) << i;
+    return mask;
+#endif
+}
+
+/**
+ * @return 0 on success; -1 on failure */
+static int __alloc_arrays(swiss_table_t * t, size_t capacity)
+{
+    void *ctrl;
+
+    if (0 != posix_memalign(&ctrl, SWISS_GROUP_SIZE, capacity))
+        return -1;
+
+    t->slots = malloc(capacity * sizeof(swiss_slot_t));
+    if (!t->slots)
+    {
+        free(ctrl);
+        return -1;
+    }
+
+    memset(ctrl, CTRL_EMPTY, capacity);
+    t->ctrl = ctrl;
+    t->capacity = capacity;
+    return 0;
+}
+
+swiss_table_t *swiss_new(void)
+{
+    swiss_table_t *t = malloc(sizeof(swiss_table_t));
+
+    if (!t)
+        return NULL;
+
+    t->count = 0;
+    t->tombstones = 0;
+    if (-1 == __alloc_arrays(t, DEFAULT_CAPACITY))
+    {
+        free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void swiss_free(swiss_table_t * t)
+{
+    free(t->ctrl);
+    free(t->slots);
+    free(t);
+}
+
+/**
+ * @return the slot holding the key; NULL if the key is not in the table */
+static swiss_slot_t *__lookup(const swiss_table_t * t, const char *key, size_t len, uint64_t hash)
+{
+    size_t mask = t->capacity / SWISS_GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & mask;
+    size_t step = 0;
+
+    for (;;)
+    {
+        const int8_t *ctrl = t->ctrl + group * SWISS_GROUP_SIZE;
+        unsigned int match = __match(ctrl, hash & TAG_MASK);
+
+        while (match)
+        {
+            swiss_slot_t *slot = &t->slots[group * SWISS_GROUP_SIZE + __builtin_ctz(match)];
+
+            if (slot->len == len && 0 == memcmp(slot->key, key, len))
+                return slot;
+            match &= match - 1;
+        }
+
+        /* the key would have been placed in this group's empty slot */
+        if (__match(ctrl, CTRL_EMPTY))
+            return NULL;
+
+        group = (group + ++step) & mask;
+    }
+}
+
+/**
+ * @return index of the first empty or deleted slot on the hash's probe sequence */
+static size_t __find_free(const swiss_table_t * t, uint64_t hash)
+{
+    size_t mask = t->capacity / SWISS_GROUP_SIZE - 1;
+    size_t group = (hash >> 7) & mask;
+    size_t step = 0;
+    unsigned int free_slots;
+
+    while (0 == (free_slots = __match_free(t->ctrl + group * SWISS_GROUP_SIZE)))
+        group = (group + ++step) & mask;
+
+    return group * SWISS_GROUP_SIZE + __builtin_ctz(free_slots);
+}
+
+/**
+ * Move all keys into new arrays of the given capacity, dropping the tombstones
+ *
+ * @return 0 on success; -1 on failure */
+static int __rehash(swiss_table_t * t, size_t capacity)
+{
+    swiss_table_t old = *t;
+    size_t i;
+
+    if (-1 == __alloc_arrays(t, capacity))
+    {
+        *t = old;
+        return -1;
+    }
+
+    for (i = 0; i < old.capacity; i++)
+    {
+        if (old.ctrl[i] >= 0)
+        {
+            uint64_t hash = __hash(old.slots[i].key, old.slots[i].len);
+            size_t idx = __find_free(t, hash);
+
+            t->ctrl[idx] = hash & TAG_MASK;
+            t->slots[idx] = old.slots[i];
+        }
+    }
+    t->tombstones = 0;
+
+    free(old.ctrl);
+    free(old.slots);
+    return 0;
+}
+
+int swiss_insert(swiss_table_t * t, const char *key, size_t len, void *value)
+{
+    uint64_t hash = __hash(key, len);
+    swiss_slot_t *slot = __lookup(t, key, len, hash);
+    size_t idx;
+
+    if (slot)
+    {
+        slot->key = key;
+        slot->value = value;
+        return 0;
+    }
+
+    /* keep at least 1/8 of the slots empty, so every probe sequence ends */
+    if ((t->count + t->tombstones + 1) * 8 > t->capacity * 7)
+    {
+        /* reclaim tombstones in place, unless the keys alone fill half the table */
+        size_t capacity = ((t->count + 1) * 2 > t->capacity) ? t->capacity * 2 : t->capacity;
+
+        if (-1 == __rehash(t, capacity))
+            return -1;
+    }
+
+    idx = __find_free(t, hash);
+    if (CTRL_DELETED == t->ctrl[idx])
+        t->tombstones--;
+
+    t->ctrl[idx] = hash & TAG_MASK;
+    t->slots[idx].key = key;
+    t->slots[idx].len = len;
+    t->slots[idx].value = value;
+    t->count++;
+    return 1;
+}
+
+void *swiss_find(const swiss_table_t * t, const char *key, size_t len)
+{
+    swiss_slot_t *slot = __lookup(t, key, len, __hash(key, len));
+
+    return slot ? slot->value : NULL;
+}
+
+void *swiss_delete(swiss_table_t * t, const char *key, size_t len)
+{
+    swiss_slot_t *slot = __lookup(t, key, len, __hash(key, len));
+    size_t idx;
+    int8_t *group;
+
+    if (!slot)
+        return NULL;
+
+    idx = slot - t->slots;
+    group = t->ctrl + idx / SWISS_GROUP_SIZE * SWISS_GROUP_SIZE;
+
+    /* no probe sequence went past a group with an empty slot, so the slot can just be emptied */
+    if (__match(group, CTRL_EMPTY))
+    {
+        t->ctrl[idx] = CTRL_EMPTY;
+    }
+    else
+    {
+        t->ctrl[idx] = CTRL_DELETED;
+        t->tombstones++;
+    }
+
+    t->count--;
+    return slot->value;
+}
+
+void swiss_iterate(const swiss_table_t * t, void (*cb) (void *value, void *udata), void *udata)
+{
+    size_t i;
+
+    for (i = 0; i < t->capacity; i++)
+        if (t->ctrl[i] >= 0)
+            cb(t->slots[i].value, udata);
+}
+
+size_t swiss_memusage(const swiss_table_t * t)
+{
+    return sizeof(swiss_table_t) + t->capacity * (1 + sizeof(swiss_slot_t));
+}
+
+size_t swiss_count(const swiss_table_t * t)
+{
+    return t->count;
+}
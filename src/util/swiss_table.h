@@ -0,0 +1,82 @@
+#ifndef SWISS_TABLE_H
+#define SWISS_TABLE_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Open addressing hash table from string keys to pointers, laid out like a "swiss table".
+ *
+ * Slots are split into groups of 16, and every slot has a control byte holding either a 7 bit
+ * tag taken from its key's hash, or a marker for an empty or deleted slot. A lookup hashes the
+ * key once, then compares the tag against a whole group of control bytes at a time (a single
+ * SSE2 compare where available) and only looks at the slots whose tag matched, so a hit costs
+ * one group of control bytes and one slot, and a miss usually stops at the first group.
+ *
+ * Keys are not copied: the table points to the key given on insertion, which must stay valid
+ * and unchanged for as long as it is in the table (e.g. a key stored inside the value itself). */
+
+#define SWISS_GROUP_SIZE 16
+
+typedef struct
+{
+    const char *key;
+    size_t len;
+    void *value;
+} swiss_slot_t;
+
+typedef struct swiss_table_s
+{
+    /* number of slots, a power of 2 and a multiple of SWISS_GROUP_SIZE */
+    size_t capacity;
+    /* keys within table */
+    size_t count;
+    /* deleted slots not yet reclaimed */
+    size_t tombstones;
+    /* one control byte per slot, 16 byte aligned */
+    int8_t *ctrl;
+    swiss_slot_t *slots;
+} swiss_table_t;
+
+/**
+ * Create new empty table.
+ *
+ * @return initialised table; NULL on failure */
+swiss_table_t *swiss_new(void);
+
+/**
+ * Free the table. Does not free the values or keys. */
+void swiss_free(swiss_table_t *t);
+
+/**
+ * Add a key, or replace the value of a key already in the table.
+ *
+ * O(1), amortized over the table doubling in size when it is 7/8 full.
+ *
+ * @param[in] key The key, which is not copied
+ * @param[in] value The key's value, must not be NULL
+ * @return 1 if the key is new, 0 if its value was replaced; -1 on failure */
+int swiss_insert(swiss_table_t *t, const char *key, size_t len, void *value);
+
+/**
+ * @return the value of the key; NULL if the key is not in the table */
+void *swiss_find(const swiss_table_t *t, const char *key, size_t len);
+
+/**
+ * Remove a key
+ *
+ * @return the key's value; NULL if the key is not in the table */
+void *swiss_delete(swiss_table_t *t, const char *key, size_t len);
+
+/**
+ * Call cb for every value in the table, in no particular order.
+ * The table must not be changed until iteration is done. */
+void swiss_iterate(const swiss_table_t *t, void (*cb) (void *value, void *udata), void *udata);
+
+/**
+ * @return number of bytes held by the table */
+size_t swiss_memusage(const swiss_table_t *t);
+
+/**
+ * @return number of keys in table */
+size_t swiss_count(const swiss_table_t *t);
+
+#endif /* SWISS_TABLE_H */
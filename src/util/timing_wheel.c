@@ -0,0 +1,246 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timing_wheel.h"
+
+static int __level_of(long long base, long long deadline)
+{
+    unsigned long long diff = (unsigned long long)(deadline ^ base);
+
+    if (0 == diff)
+        return 0;
+
+    return (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+}
+
+static int __slot_of(long long deadline, int level)
+{
+    return ((unsigned long long)deadline >> (level * WHEEL_BITS)) & WHEEL_MASK;
+}
+
+timing_wheel_t *wheel_new(void)
+{
+    timing_wheel_t *w = calloc(1, sizeof(timing_wheel_t));
+
+    return w;
+}
+
+void wheel_free(timing_wheel_t * w)
+{
+    free(w);
+}
+
+static void __link(timing_wheel_t * w, wheel_node_t * n)
+{
+    int level = __level_of(w->base, n->deadline);
+    int slot = __slot_of(n->deadline, level);
+    wheel_node_t **head = &w->slots[level][slot];
+
+    n->bucket = level * WHEEL_SLOTS + slot;
+    n->prev = NULL;
+    n->next = *head;
+    if (*head)
+        (*head)->prev = n;
+    *head = n;
+
+    w->occupied[level] |= 1ULL << slot;
+}
+
+static void __unlink(timing_wheel_t * w, wheel_node_t * n)
+{
+    int level = n->bucket / WHEEL_SLOTS;
+    int slot = n->bucket % WHEEL_SLOTS;
+
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        w->slots[level][slot] = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+
+    if (NULL == w->slots[level][slot])
+        w->occupied[level] &= ~(1ULL << slot);
+
+    n->next = n->prev = NULL;
+}
+
+/**
+ * Re-link every node of a slot relative to the current base */
+static void __relink_slot(timing_wheel_t * w, int level, int slot)
+{
+    wheel_node_t *n = w->slots[level][slot];
+
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ULL << slot);
+
+    while (n)
+    {
+        wheel_node_t *next = n->next;
+
+        __link(w, n);
+        n = next;
+    }
+}
+
+/**
+ * Move the base forward to a deadline that is not later than any stored deadline, and cascade
+ * the nodes that now share a higher level slot with the base down the wheel */
+static void __advance(timing_wheel_t * w, long long base)
+{
+    int level;
+
+    w->base = base;
+
+    /* top down, so nodes cascaded into the base's slot one level lower get cascaded again */
+    for (level = WHEEL_LEVELS - 1; level > 0; level--)
+    {
+        int slot = __slot_of(base, level);
+
+        if (w->occupied[level] & (1ULL << slot))
+            __relink_slot(w, level, slot);
+    }
+}
+
+/**
+ * Re-link all nodes relative to a new, earlier, base */
+static void __rebase(timing_wheel_t * w, long long base)
+{
+    wheel_node_t *all = NULL;
+    int level, slot;
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        while (w->occupied[level])
+        {
+            slot = __builtin_ctzll(w->occupied[level]);
+
+            wheel_node_t *n = w->slots[level][slot];
+
+            while (n)
+            {
+                wheel_node_t *next = n->next;
+
+                n->next = all;
+                all = n;
+                n = next;
+            }
+            w->slots[level][slot] = NULL;
+            w->occupied[level] &= ~(1ULL << slot);
+        }
+    }
+
+    w->base = base;
+    while (all)
+    {
+        wheel_node_t *next = all->next;
+
+        __link(w, all);
+        all = next;
+    }
+}
+
+void wheel_offer(timing_wheel_t * w, wheel_node_t * node, long long deadline)
+{
+    node->deadline = deadline;
+
+    if (deadline < w->base)
+        __rebase(w, deadline);
+
+    __link(w, node);
+    w->count++;
+
+    if (w->min && deadline < w->min->deadline)
+        w->min = node;
+}
+
+/**
+ * @return the earliest node; NULL if the wheel is empty */
+static wheel_node_t *__find_min(timing_wheel_t * w)
+{
+    int level;
+
+    /* every node on level 0 holds an exact deadline, the first occupied slot wins */
+    if (w->occupied[0])
+        return w->slots[0][__builtin_ctzll(w->occupied[0])];
+
+    /* otherwise the earliest node is in the first occupied slot of the lowest occupied level */
+    for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+        if (w->occupied[level])
+        {
+            int slot = __builtin_ctzll(w->occupied[level]);
+            wheel_node_t *n, *min = w->slots[level][slot];
+
+            for (n = min->next; n; n = n->next)
+                if (n->deadline < min->deadline)
+                    min = n;
+
+            return min;
+        }
+    }
+
+    return NULL;
+}
+
+wheel_node_t *wheel_peek(timing_wheel_t * w)
+{
+    if (0 == w->count)
+        return NULL;
+
+    if (NULL == w->min)
+        w->min = __find_min(w);
+
+    return w->min;
+}
+
+wheel_node_t *wheel_poll(timing_wheel_t * w)
+{
+    wheel_node_t *n = wheel_peek(w);
+
+    if (NULL == n)
+        return NULL;
+
+    __unlink(w, n);
+    w->count--;
+    w->min = NULL;
+
+    __advance(w, n->deadline);
+
+    return n;
+}
+
+void wheel_remove(timing_wheel_t * w, wheel_node_t * node)
+{
+    __unlink(w, node);
+    w->count--;
+
+    if (w->min == node)
+        w->min = NULL;
+}
+
+void wheel_iterate(const timing_wheel_t * w, void (*cb) (wheel_node_t * node, void *udata),
+                   void *udata)
+{
+    int level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        uint64_t occupied = w->occupied[level];
+
+        while (occupied)
+        {
+            int slot = __builtin_ctzll(occupied);
+            wheel_node_t *n;
+
+            for (n = w->slots[level][slot]; n; n = n->next)
+                cb(n, udata);
+            occupied &= occupied - 1;
+        }
+    }
+}
+
+unsigned int wheel_count(const timing_wheel_t * w)
+{
+    return w->count;
+}
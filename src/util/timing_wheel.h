@@ -0,0 +1,99 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hierarchical hashed timing wheel keyed on millisecond deadlines.
+ *
+ * Level 0 has one slot per millisecond, and every level above it covers WHEEL_SLOTS times the
+ * range of the level below. A deadline is placed on the level of the highest bit in which it
+ * differs from the wheel's base time, so every node on level 0 carries an exact deadline and
+ * insertion is O(1). Nodes sitting on higher levels are cascaded down as the base advances.
+ *
+ * Nodes are intrusive: embed a wheel_node_t in your own struct and use wheel_entry() to get
+ * back to it. The wheel never allocates per node. */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+/* enough levels for WHEEL_BITS * WHEEL_LEVELS to cover a full 64 bit deadline */
+#define WHEEL_LEVELS 11
+
+typedef struct wheel_node_s
+{
+    struct wheel_node_s *next;
+    struct wheel_node_s *prev;
+    long long deadline;
+    /* level * WHEEL_SLOTS + slot */
+    unsigned short bucket;
+} wheel_node_t;
+
+typedef struct timing_wheel_s
+{
+    /* no stored deadline is smaller than base */
+    long long base;
+    /* nodes within wheel */
+    unsigned int count;
+    /* cached earliest node, NULL when it needs to be looked up again */
+    wheel_node_t *min;
+    /* one bit per non empty slot */
+    uint64_t occupied[WHEEL_LEVELS];
+    wheel_node_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timing_wheel_t;
+
+/**
+ * Get the struct containing the given wheel node */
+#define wheel_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * Create new empty wheel.
+ *
+ * malloc()s space for the wheel.
+ *
+ * @return initialised wheel; NULL on failure */
+timing_wheel_t *wheel_new(void);
+
+/**
+ * Free the wheel. Does not touch the nodes still linked into it. */
+void wheel_free(timing_wheel_t *w);
+
+/**
+ * Add node to be triggered at deadline.
+ *
+ * O(1), unless the deadline is earlier than a deadline already polled out of the wheel, in
+ * which case the whole wheel is re-based on the new deadline.
+ *
+ * @param[in] node The node to be added, must not be linked into any wheel
+ * @param[in] deadline Absolute deadline in milliseconds */
+void wheel_offer(timing_wheel_t *w, wheel_node_t *node, long long deadline);
+
+/**
+ * @return node with the earliest deadline; NULL if the wheel is empty */
+wheel_node_t *wheel_peek(timing_wheel_t *w);
+
+/**
+ * Remove the node with the earliest deadline
+ *
+ * @return the removed node; NULL if the wheel is empty */
+wheel_node_t *wheel_poll(timing_wheel_t *w);
+
+/**
+ * Remove a node linked into the wheel
+ *
+ * O(1).
+ *
+ * @param[in] node The node to be removed */
+void wheel_remove(timing_wheel_t *w, wheel_node_t *node);
+
+/**
+ * Call cb for every node in the wheel, in no particular order.
+ * The wheel must not be changed until iteration is done. */
+void wheel_iterate(const timing_wheel_t *w, void (*cb) (wheel_node_t *node, void *udata),
+                   void *udata);
+
+/**
+ * @return number of nodes in wheel */
+unsigned int wheel_count(const timing_wheel_t *w);
+
+#endif /* TIMING_WHEEL_H */